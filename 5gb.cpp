@@ -4,14 +4,35 @@
 #include <cmath>
 #include <thread>
 #include <atomic>
-#include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
 #include <fstream>
-#include <deque>
 #include <algorithm>
+#include <array>
 #include <SDL2/SDL.h>
 #include <portaudio.h>
 
-const int SAMPLE_RATE = 44100;
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Device sample rate and block size, overridable from the CLI
+// (--rate 44100|48000|96000, --buffer, minimum 64 frames). Set once at
+// startup before any audio runs, then read-only
+int SAMPLE_RATE = 44100;
+unsigned long FRAMES_PER_BUFFER = 256;
+// WAV capture rate (--capture-rate); when it differs from the device
+// rate the capture path resamples
+int CAPTURE_RATE = 44100;
 const float AMPLITUDE = 0.5f;
 
 // Window dimensions
@@ -64,6 +85,14 @@ std::unordered_map<SDL_Keycode, float> CHANNEL3_NOTES = {
     {SDLK_7, 246.94f}   // B3
 };
 
+// Noise channel "notes": the value is the LFSR shift rate in Hz rather
+// than a pitch. Three rates cover hat / snare / kick-ish percussion.
+std::unordered_map<SDL_Keycode, float> CHANNEL4_NOTES = {
+    {SDLK_8, 32768.0f},  // High (hi-hat)
+    {SDLK_9, 8192.0f},   // Mid (snare)
+    {SDLK_0, 2048.0f}    // Low (kick)
+};
+
 // Map note frequencies to staff positions
 std::unordered_map<float, int> NOTE_POSITIONS = {
     {261.63f, 10},  // C4
@@ -79,7 +108,11 @@ std::unordered_map<float, int> NOTE_POSITIONS = {
     {698.46f, 0},   // F5
     {783.99f, -1},  // G5
     {880.00f, -2},  // A5
-    {987.77f, -3}   // B5
+    {987.77f, -3},  // B5
+    // Noise rates sit above the staff like percussion cues
+    {32768.0f, -4},
+    {8192.0f, -5},
+    {2048.0f, -6}
 };
 
 // Piano key information
@@ -100,40 +133,571 @@ enum NoteType {
     QUARTER_NOTE  // Longer note
 };
 
-// Note on the staff
+// Note on the staff. Playback never mutates these: whether a note is
+// currently sounding is derived at draw time from the sample clock
+// (notePlayingNow), so the renderer and the playback cursor never race
+// over shared flags
 struct StaffNote {
     float frequency;
     int position;  // Relative to middle line
     int x;
     int channel;   // 1, 2, or 3
-    bool isPlaying;
     NoteType type; // Eighth or quarter note
 };
 
-// Sound generation state
+// ---- Band-limited wavetables ----
+// The naive (phase < 0.5) square aliases badly above A5: every harmonic
+// past Nyquist folds back into the audible range. These tables hold
+// Fourier pulses built from only the harmonics that fit below Nyquist,
+// one mip level per octave of fundamental and one set per GB duty cycle
+// (12.5/25/50/75%). They are generated at compile time with constexpr, so
+// there is no startup cost and no runtime trig.
+// Sizes are chosen to keep constexpr evaluation inside the compiler's
+// default operation limit, so a plain `g++ 5gb.cpp` still works
+const int WAVETABLE_BITS = 9;
+const int WAVETABLE_SIZE = 1 << WAVETABLE_BITS;  // 512 samples per table
+const int WAVETABLE_MIPS = 10;                   // fundamentals ~27.5Hz..14kHz
+const float WAVETABLE_BASE_FREQ = 27.5f;         // A0, bottom of mip 0
+const int WAVETABLE_MAX_HARMONICS = 32;
+// The tables are designed against the 44.1kHz Nyquist at compile time;
+// at the higher device rates they are simply extra-safe against aliasing
+const int WAVETABLE_DESIGN_RATE = 44100;
+
+const int WAVETABLE_DUTIES = 4;
+constexpr double WAVETABLE_DUTY[WAVETABLE_DUTIES] = {0.125, 0.25, 0.5, 0.75};
+
+// Compile-time sine (range reduction + Taylor series); only used while
+// building the tables
+constexpr double ctSin(double x) {
+    const double CT_PI = 3.14159265358979323846;
+    const double CT_TWO_PI = 2.0 * CT_PI;
+    x -= CT_TWO_PI * static_cast<long long>(x / CT_TWO_PI);
+    if (x > CT_PI) x -= CT_TWO_PI;
+    if (x < -CT_PI) x += CT_TWO_PI;
+
+    double x2 = x * x;
+    double term = x;
+    double sum = x;
+    for (int n = 1; n <= 9; n++) {
+        term *= -x2 / static_cast<double>((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+// Highest harmonic that stays below Nyquist anywhere in a mip's octave
+constexpr int mipHarmonics(int mip) {
+    double topFreq = WAVETABLE_BASE_FREQ;
+    for (int i = 0; i <= mip; i++) {
+        topFreq *= 2.0;
+    }
+    int harmonics = static_cast<int>((WAVETABLE_DESIGN_RATE / 2.0) / topFreq);
+    if (harmonics < 1) harmonics = 1;
+    if (harmonics > WAVETABLE_MAX_HARMONICS) harmonics = WAVETABLE_MAX_HARMONICS;
+    return harmonics;
+}
+
+struct Wavetables {
+    float pulse[WAVETABLE_DUTIES][WAVETABLE_MIPS][WAVETABLE_SIZE];
+};
+
+constexpr Wavetables buildWavetables() {
+    const double CT_PI = 3.14159265358979323846;
+    Wavetables w{};
+
+    // cos(k * x_i) for x_i = 2*pi*i/SIZE is just this table at (k*i) mod
+    // SIZE, so the Taylor sine runs SIZE times total instead of once per
+    // harmonic per sample — that's what keeps four duty variants inside
+    // the compiler's constexpr operation limit
+    double cosTab[WAVETABLE_SIZE] = {};
+    for (int i = 0; i < WAVETABLE_SIZE; i++) {
+        cosTab[i] = ctSin(CT_PI / 2.0 - 2.0 * CT_PI * i / WAVETABLE_SIZE);
+    }
+
+    for (int d = 0; d < WAVETABLE_DUTIES; d++) {
+        for (int mip = 0; mip < WAVETABLE_MIPS; mip++) {
+            int harmonics = mipHarmonics(mip);
+            // Pulse with duty D: harmonic k weighs sin(k*pi*D)/k (the DC
+            // term is dropped — the output is AC anyway). D = 0.5 kills
+            // the even harmonics and gives the familiar square
+            double coeff[WAVETABLE_MAX_HARMONICS + 1] = {};
+            for (int k = 1; k <= harmonics; k++) {
+                coeff[k] = ctSin(k * CT_PI * WAVETABLE_DUTY[d]) * 4.0 /
+                           (CT_PI * k);
+            }
+            for (int i = 0; i < WAVETABLE_SIZE; i++) {
+                double sum = 0.0;
+                for (int k = 1; k <= harmonics; k++) {
+                    sum += coeff[k] * cosTab[(k * i) & (WAVETABLE_SIZE - 1)];
+                }
+                w.pulse[d][mip][i] = static_cast<float>(sum);
+            }
+        }
+    }
+    return w;
+}
+
+constexpr Wavetables WAVETABLES = buildWavetables();
+
+// Pick the mip whose harmonic count is safe for this fundamental
+inline const float* pulseTableFor(int duty, float frequency) {
+    int mip = 0;
+    float top = WAVETABLE_BASE_FREQ * 2.0f;
+    while (mip < WAVETABLE_MIPS - 1 && frequency >= top) {
+        mip++;
+        top *= 2.0f;
+    }
+    return WAVETABLES.pulse[duty][mip];
+}
+
+// Sound generation state.
+// The UI thread publishes {active, frequency} as a single packed 64-bit word
+// so the audio callback can pick up a consistent snapshot with one atomic
+// load instead of taking a mutex. The old per-channel std::mutex could make
+// the PortAudio callback block behind the event loop and cause xruns.
 class ChannelState {
 public:
-    std::mutex lock;
-    bool active = false;
-    float frequency = 0.0f;
-    float phase = 0.0f;
+    struct Params {
+        bool active;
+        float frequency;
+    };
+
+    // UI thread: start playing a note at the given frequency
+    void noteOn(float frequency) {
+        packed.store(pack(true, frequency), std::memory_order_release);
+    }
+
+    // UI thread: stop the note, keeping the last frequency
+    void noteOff() {
+        packed.fetch_and(~ACTIVE_BIT, std::memory_order_release);
+    }
+
+    // Audio thread: read the current parameters without blocking
+    Params load() const {
+        uint64_t bits = packed.load(std::memory_order_acquire);
+        Params p;
+        p.active = (bits & ACTIVE_BIT) != 0;
+        uint32_t freqBits = static_cast<uint32_t>(bits);
+        std::memcpy(&p.frequency, &freqBits, sizeof(float));
+        return p;
+    }
+
+    // 32-bit fixed-point phase: the full uint32_t range maps to one cycle,
+    // so wraparound is free integer overflow and a table index is a shift
+    // of the top bits. Only touched by the audio thread
+    uint32_t phase = 0;
+
+private:
+    static const uint64_t ACTIVE_BIT = 1ull << 32;
+
+    static uint64_t pack(bool active, float frequency) {
+        uint32_t freqBits;
+        std::memcpy(&freqBits, &frequency, sizeof(float));
+        return (active ? ACTIVE_BIT : 0) | freqBits;
+    }
+
+    std::atomic<uint64_t> packed{0};
+};
+
+// ---- Voice pool ----
+// A fixed, preallocated pool so several notes can sound on one channel at
+// once; previously each channel held exactly one frequency and a second
+// keypress stole the note, making chords within a channel impossible. The
+// UI thread claims and releases slots with an atomic channel tag; the audio
+// callback walks the contiguous array and mixes every active voice, so
+// there is no heap traffic after init and no locking anywhere.
+const int MAX_VOICES = 16;
+
+struct Voice {
+    ChannelState state;           // packed {active, frequency} + phase
+    std::atomic<int> channel{0};  // 1..4 while claimed, 0 when free
+
+    // Audio-thread-only state for noise voices. The GB LFSR: a 15-bit
+    // shift register clocked by an integer divider at the selected rate.
+    uint16_t lfsr = 0x7FFF;
+    int divider = 0;
+
+    // Duty, envelope, and length counter, snapshotted from the global
+    // performance settings when the note starts. The frame sequencer
+    // clocks the envelope and length; within a rendered block the
+    // envelope level is a constant gain.
+    uint8_t duty = 2;       // index into WAVETABLE_DUTY (2 = 50%)
+    int envLevel = 15;      // 4-bit GB volume level
+    int envPeriod = 0;      // 0 = envelope off; 1..7 in 64Hz ticks
+    bool envUp = false;
+    int envDivider = 0;     // 64Hz ticks until the next envelope step
+    int lengthCounter = 0;  // 256Hz ticks until auto-release; 0 = ring
+};
+
+Voice VOICES[MAX_VOICES];
+
+// Wave pattern shared by all wave-channel voices: 16 samples of 4 bits,
+// like the hardware wave RAM. WAVE_LEVELS (0..15) is what the editor
+// panel draws and edits; WAVE_PATTERN holds the derived float samples
+// the callback reads with two taps and a lerp. The floats are atomics
+// (relaxed, same as the other UI->audio parameters) because the editor
+// writes them mid-note while the callback and its mix worker read them;
+// relaxed loads compile to plain loads on x86, so the read side is free
+const int WAVE_SAMPLES = 16;
+uint8_t WAVE_LEVELS[WAVE_SAMPLES] = {
+    8, 9, 11, 12, 14, 15, 14, 12, 8, 6, 4, 3, 1, 0, 1, 3
+};
+std::atomic<float> WAVE_PATTERN[WAVE_SAMPLES];
+
+// Set one wave sample from its 4-bit level and refresh the float mirror
+void setWaveLevel(int index, int level) {
+    level = std::max(0, std::min(15, level));
+    WAVE_LEVELS[index] = static_cast<uint8_t>(level);
+    WAVE_PATTERN[index].store(level / 7.5f - 1.0f, std::memory_order_relaxed);
+}
+
+// Derive the float table from WAVE_LEVELS; call once at startup
+void initWavePattern() {
+    for (int i = 0; i < WAVE_SAMPLES; i++) {
+        setWaveLevel(i, WAVE_LEVELS[i]);
+    }
+}
+
+// Wave editor panel layout: 16 columns under the note-type box, one per
+// wave sample, each 16 clickable levels tall
+const int WAVE_EDITOR_X = WINDOW_WIDTH - 150;
+const int WAVE_EDITOR_Y = 100;
+const int WAVE_EDITOR_COL = 8;   // column width in pixels
+const int WAVE_EDITOR_STEP = 4;  // height of one 4-bit level in pixels
+
+// 7-bit LFSR mode repeats every 127 steps and gives the metallic GB tone
+std::atomic<bool> NOISE_SEVEN_BIT(false);
+
+// Performance settings applied to new notes: pulse duty cycle and the GB
+// volume envelope (a 4-bit level stepped every period/64 seconds, rising
+// or decaying). W cycles the duty, E flips the direction, -/= adjust the
+// period. Snapshotted into the voice at noteOn
+std::atomic<int> PULSE_DUTY(2);   // index into WAVETABLE_DUTY
+std::atomic<int> ENV_PERIOD(0);   // 0 = off
+std::atomic<bool> ENV_UP(false);
+std::atomic<int> NOTE_LENGTH(0);  // length counter in 256Hz ticks; 0 = ring
+
+// Load the current performance settings into a claimed voice and start it
+static void armVoice(Voice& v, float frequency) {
+    v.duty = static_cast<uint8_t>(PULSE_DUTY.load(std::memory_order_relaxed));
+    v.envPeriod = ENV_PERIOD.load(std::memory_order_relaxed);
+    v.envUp = ENV_UP.load(std::memory_order_relaxed);
+    // Decay starts loud, a rising envelope starts silent
+    v.envLevel = v.envUp ? 0 : 15;
+    v.envDivider = v.envPeriod;
+    v.lengthCounter = NOTE_LENGTH.load(std::memory_order_relaxed);
+    v.state.noteOn(frequency);
+}
+
+// ---- Frame sequencer ----
+// The GB APU articulates everything from a 512Hz frame sequencer derived
+// from the sample clock. Same here: an integer counter fires every
+// SAMPLE_RATE/512 samples and walks an eight-frame cycle — length
+// counters clock on the even frames (256Hz), envelopes on the last frame
+// (64Hz) — so articulation costs a handful of integer ops per ~86-sample
+// frame and nothing per sample. Each pool advances its own sequencer so
+// the offline render threads stay deterministic and independent.
+struct FrameSequencer {
+    int sampleCounter = 0;
+    int frame = 0;  // 0..7
+};
+
+void advanceFrameSequencer(Voice* pool, FrameSequencer& fs,
+                           unsigned long frames) {
+    const int FRAME_SAMPLES = SAMPLE_RATE / 512;
+    fs.sampleCounter += static_cast<int>(frames);
+    while (fs.sampleCounter >= FRAME_SAMPLES) {
+        fs.sampleCounter -= FRAME_SAMPLES;
+        fs.frame = (fs.frame + 1) & 7;
+        bool lengthTick = (fs.frame & 1) == 0;
+        bool envTick = fs.frame == 7;
+        if (!lengthTick && !envTick) continue;
+
+        for (int i = 0; i < MAX_VOICES; i++) {
+            Voice& v = pool[i];
+            if (v.channel.load(std::memory_order_acquire) == 0) continue;
+            // Gate on the packed state like renderPool does: armVoice
+            // writes the articulation fields before the release store
+            // that flips active, so a voice the UI has claimed but not
+            // finished arming is skipped instead of clocked on stale
+            // fields (a stale length counter could expire and free it)
+            if (!v.state.load().active) continue;
+
+            if (lengthTick && v.lengthCounter > 0) {
+                if (--v.lengthCounter == 0) {
+                    // Expired: silence and free the voice, like hardware
+                    // disabling the channel
+                    v.state.noteOff();
+                    v.channel.store(0, std::memory_order_release);
+                    continue;
+                }
+            }
+            if (envTick && v.envPeriod > 0 && --v.envDivider <= 0) {
+                v.envDivider = v.envPeriod;
+                if (v.envUp && v.envLevel < 15) {
+                    v.envLevel++;
+                } else if (!v.envUp && v.envLevel > 0) {
+                    v.envLevel--;
+                }
+            }
+        }
+    }
+}
+
+// Start a note on the given channel, claiming a free voice from the pool.
+// The offline renderer passes its own private pools, so these take the
+// pool explicitly; the live path uses VOICES.
+void poolVoiceOn(Voice* pool, int channel, float frequency) {
+    for (int i = 0; i < MAX_VOICES; i++) {
+        Voice& v = pool[i];
+        int expected = 0;
+        if (v.channel.compare_exchange_strong(expected, channel)) {
+            armVoice(v, frequency);
+            return;
+        }
+    }
+    // Pool exhausted: retrigger the first voice already on this channel.
+    // Only the packed state is touched — a renderer may be reading the
+    // articulation fields of a live voice this very block, so the stolen
+    // voice keeps its envelope and length counter and just changes pitch
+    for (int i = 0; i < MAX_VOICES; i++) {
+        Voice& v = pool[i];
+        if (v.channel.load() == channel) {
+            v.state.noteOn(frequency);
+            return;
+        }
+    }
+}
+
+// Release the voice playing this frequency on this channel
+void poolVoiceOff(Voice* pool, int channel, float frequency) {
+    for (int i = 0; i < MAX_VOICES; i++) {
+        Voice& v = pool[i];
+        if (v.channel.load() == channel) {
+            ChannelState::Params p = v.state.load();
+            if (p.active && p.frequency == frequency) {
+                v.state.noteOff();
+                v.channel.store(0);
+                return;
+            }
+        }
+    }
+}
+
+void voiceOn(int channel, float frequency) { poolVoiceOn(VOICES, channel, frequency); }
+void voiceOff(int channel, float frequency) { poolVoiceOff(VOICES, channel, frequency); }
+
+// Silence and free every live voice
+void allVoicesOff() {
+    for (auto& v : VOICES) {
+        v.state.noteOff();
+        v.channel.store(0);
+    }
+}
+
+// Lock-free single-producer/single-consumer ring buffer for WAV capture.
+// The audio callback pushes samples and the capture thread drains them to
+// the streaming WAV writer, so the real-time path never allocates: the
+// old WAV_BUFFER.push_back in audioCallback could trigger a vector regrow
+// mid-callback and glitch. Samples are stored as int16 — the WAV output
+// is 16-bit anyway, so converting at the producer halves the ring and
+// everything downstream of it. Capacity is a power of two so indices wrap
+// with a mask.
+class CaptureRing {
+public:
+    static const size_t CAPACITY = 1 << 16;  // ~1.5 seconds at 44100Hz
+
+    // Audio thread: returns false if the ring is full (sample dropped).
+    // The caller has already clipped to [-1, 1]
+    bool push(float sample) {
+        size_t head = writeIndex.load(std::memory_order_relaxed);
+        size_t next = (head + 1) & (CAPACITY - 1);
+        if (next == readIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        buffer[head] = static_cast<int16_t>(sample * 32767.0f);
+        writeIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Capture thread: move everything currently in the ring into out
+    void drainTo(std::vector<int16_t>& out) {
+        size_t tail = readIndex.load(std::memory_order_relaxed);
+        size_t head = writeIndex.load(std::memory_order_acquire);
+        while (tail != head) {
+            out.push_back(buffer[tail]);
+            tail = (tail + 1) & (CAPACITY - 1);
+        }
+        readIndex.store(tail, std::memory_order_release);
+    }
+
+private:
+    int16_t buffer[CAPACITY];
+    std::atomic<size_t> writeIndex{0};
+    std::atomic<size_t> readIndex{0};
+};
+
+CaptureRing CAPTURE_RING;
+
+// ---- MIDI input ----
+// External-keyboard input skips the SDL loop (and its ~10ms poll sleep)
+// entirely: a reader thread pushes raw note events into this SPSC ring
+// and the audio callback drains it at block start, so MIDI latency is
+// bounded by the audio buffer alone. The reader itself is ALSA rawmidi
+// and only built with `make MIDI=1`; the ring and the drain are always
+// compiled so the callback does not change shape between builds.
+struct MidiEvent {
+    uint8_t status;    // 0x8n note-off / 0x9n note-on
+    uint8_t note;      // MIDI note number
+    uint8_t velocity;
 };
 
-// Wave channel has a different waveform
-class WaveChannelState : public ChannelState {
+class MidiRing {
 public:
-    // Wave pattern (16 samples of 4-bit each)
-    std::vector<float> waveform = {
-        0.0f, 0.2f, 0.4f, 0.6f, 0.8f, 1.0f, 0.8f, 0.6f,
-        0.0f, -0.2f, -0.4f, -0.6f, -0.8f, -1.0f, -0.8f, -0.6f
-    };
-    size_t wavePos = 0;
+    static const size_t CAPACITY = 256;
+
+    // MIDI thread: returns false if the ring is full (event dropped)
+    bool push(const MidiEvent& ev) {
+        size_t head = writeIndex.load(std::memory_order_relaxed);
+        size_t next = (head + 1) & (CAPACITY - 1);
+        if (next == readIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        buffer[head] = ev;
+        writeIndex.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Audio thread: returns false when the ring is empty
+    bool pop(MidiEvent& ev) {
+        size_t tail = readIndex.load(std::memory_order_relaxed);
+        if (tail == writeIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        ev = buffer[tail];
+        readIndex.store((tail + 1) & (CAPACITY - 1), std::memory_order_release);
+        return true;
+    }
+
+private:
+    MidiEvent buffer[CAPACITY];
+    std::atomic<size_t> writeIndex{0};
+    std::atomic<size_t> readIndex{0};
+};
+
+MidiRing MIDI_RING;
+
+// Equal-tempered frequency per MIDI note, so the callback never calls pow
+const std::array<float, 128> MIDI_NOTE_FREQ = [] {
+    std::array<float, 128> f{};
+    for (int n = 0; n < 128; n++) {
+        f[n] = 440.0f * std::pow(2.0f, (n - 69) / 12.0f);
+    }
+    return f;
+}();
+
+// A staff compiled into a flat, sample-accurate event list. startPlayback
+// builds one of these and hands it to the audio callback, which applies
+// note-ons/offs on exact sample boundaries. The old scheme advanced a pixel
+// cursor from the SDL loop every 50ms, which gave +/-50ms of onset jitter.
+struct SeqEvent {
+    uint64_t sampleTime;
+    int channel;
+    float frequency;
+    bool isOn;
+};
+
+struct Sequence {
+    std::vector<SeqEvent> events;
+    uint64_t endSample = 0;
+};
+
+// Handoff slots between the UI thread and the audio callback. The UI
+// publishes a freshly compiled Sequence through SEQ_PENDING; the callback
+// adopts it and parks the previous one in SEQ_RETIRED for the UI thread to
+// delete later, so the real-time path never allocates or frees. While the
+// retired slot is occupied the callback defers adoption, so parking can
+// never clobber (and thus have to delete) an unfreed sequence.
+std::atomic<Sequence*> SEQ_PENDING(nullptr);
+std::atomic<Sequence*> SEQ_RETIRED(nullptr);
+std::atomic<bool> SEQ_ACTIVE(false);
+std::atomic<uint64_t> SEQ_SAMPLE(0);
+
+// ---- Perf instrumentation ----
+// Lock-free counters the audio callback updates with relaxed atomics, so
+// measuring never perturbs the real-time path. The UI thread drains them
+// every couple of seconds for the stats line and reads them for the HUD
+// (toggled with F1). Callback durations also go into a log2-microsecond
+// histogram so rough percentiles can be reported.
+struct PerfStats {
+    static const int HIST_BUCKETS = 16;
+
+    std::atomic<uint64_t> callbackCount{0};
+    std::atomic<uint64_t> callbackTotalUs{0};
+    std::atomic<uint32_t> callbackMaxUs{0};
+    std::atomic<uint32_t> xruns{0};
+    std::atomic<uint32_t> histogram[HIST_BUCKETS];
+
+    // Audio thread, once per callback
+    void record(uint32_t us, PaStreamCallbackFlags statusFlags) {
+        callbackCount.fetch_add(1, std::memory_order_relaxed);
+        callbackTotalUs.fetch_add(us, std::memory_order_relaxed);
+
+        uint32_t prevMax = callbackMaxUs.load(std::memory_order_relaxed);
+        while (us > prevMax &&
+               !callbackMaxUs.compare_exchange_weak(prevMax, us,
+                                                    std::memory_order_relaxed)) {
+        }
+
+        if (statusFlags & (paOutputUnderflow | paOutputOverflow)) {
+            xruns.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        int bucket = 0;
+        while ((1u << bucket) < us && bucket < HIST_BUCKETS - 1) {
+            bucket++;
+        }
+        histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // UI thread: microsecond value at the given percentile since the last
+    // drain, estimated from the histogram bucket upper bounds
+    uint32_t percentileUs(double fraction) {
+        uint64_t total = 0;
+        uint32_t counts[HIST_BUCKETS];
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            counts[i] = histogram[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0) return 0;
+        uint64_t threshold = static_cast<uint64_t>(total * fraction);
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= threshold) return 1u << i;
+        }
+        return 1u << (HIST_BUCKETS - 1);
+    }
+
+    // UI thread: reset the interval counters after a stats line
+    void resetInterval() {
+        callbackCount.store(0, std::memory_order_relaxed);
+        callbackTotalUs.store(0, std::memory_order_relaxed);
+        callbackMaxUs.store(0, std::memory_order_relaxed);
+        for (auto& h : histogram) {
+            h.store(0, std::memory_order_relaxed);
+        }
+    }
 };
 
-ChannelState CH1;
-ChannelState CH2;
-WaveChannelState CH3;
-std::vector<float> WAV_BUFFER;
+PerfStats PERF;
+bool showPerfHud = false;
+PaStream* AUDIO_STREAM = nullptr;  // for Pa_GetStreamCpuLoad from the UI thread
+
+// Playback tempo: staff pixels per second (matches the old 2px-per-50ms tick)
+const int PLAYBACK_PX_PER_SEC = 40;
+// Base duration of an eighth note; quarter notes last twice as long
+const float EIGHTH_NOTE_SECONDS = 0.25f;
 std::atomic<bool> QUIT_FLAG(false);
 std::vector<PianoKey> pianoKeys;
 std::vector<StaffNote> staffNotes;
@@ -144,7 +708,59 @@ NoteType currentNoteType = EIGHTH_NOTE;
 int scrollOffset = 0;
 bool isPlayingSequence = false;
 int playbackPosition = 0;
-std::deque<StaffNote> playbackQueue;
+// Set whenever something visible changed; the main loop only repaints when
+// this is true, so an idle window costs ~no CPU
+bool needsRedraw = true;
+
+#ifdef GB_MIDI
+#include <alsa/asoundlib.h>
+
+// ALSA rawmidi reader: parses note-on/off (with running status) straight
+// off the wire and pushes them into MIDI_RING. Non-blocking reads with a
+// short sleep so the thread notices QUIT_FLAG promptly. The device comes
+// from $GB_MIDI_DEVICE, defaulting to "default" (see amidi -l)
+std::thread MIDI_THREAD;
+
+void midiThreadMain() {
+    const char* device = getenv("GB_MIDI_DEVICE");
+    if (!device) device = "default";
+
+    snd_rawmidi_t* in = nullptr;
+    if (snd_rawmidi_open(&in, nullptr, device, SND_RAWMIDI_NONBLOCK) < 0) {
+        std::cerr << "MIDI: could not open rawmidi device " << device << std::endl;
+        return;
+    }
+    std::cout << "MIDI: reading from " << device << std::endl;
+
+    uint8_t status = 0;
+    uint8_t data[2];
+    int have = 0;
+    while (!QUIT_FLAG) {
+        uint8_t byte;
+        ssize_t n = snd_rawmidi_read(in, &byte, 1);
+        if (n != 1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (byte & 0x80) {
+            if (byte >= 0xF8) continue;  // realtime bytes don't touch status
+            status = byte;
+            have = 0;
+            continue;
+        }
+        data[have++] = byte;
+        if (have == 2) {
+            have = 0;  // running status: keep parsing pairs
+            uint8_t kind = status & 0xF0;
+            if (kind == 0x90 || kind == 0x80) {
+                MIDI_RING.push({status, data[0], data[1]});
+            }
+        }
+    }
+
+    snd_rawmidi_close(in);
+}
+#endif  // GB_MIDI
 
 // WAV file helpers
 struct WavHeader {
@@ -168,30 +784,213 @@ struct WavHeader {
     uint32_t data_bytes = 0;               // NumSamples * NumChannels * BitsPerSample/8
 };
 
-void saveWav(const std::string& filename, const std::vector<float>& buffer) {
-    std::vector<int16_t> pcm_data(buffer.size());
-    
-    // Convert float samples to 16-bit PCM
-    for (size_t i = 0; i < buffer.size(); ++i) {
-        float clipped = std::max(-1.0f, std::min(1.0f, buffer[i]));
-        pcm_data[i] = static_cast<int16_t>(clipped * 32767.0f);
+// Incremental WAV writer. PCM chunks are flushed to disk as the session
+// runs and the header sizes are patched on close, so resident memory stays
+// flat no matter how long the session is. The old saveWav kept every sample
+// of the session in RAM and converted/wrote it all at once at shutdown.
+class WavWriter {
+public:
+    bool open(const std::string& path, int rate = SAMPLE_RATE) {
+        filename = path;
+        sampleRate = rate;
+        file.open(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open file for writing: " << path << std::endl;
+            return false;
+        }
+        // Placeholder header, sizes patched in close()
+        WavHeader header = makeHeader();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(WavHeader));
+        return true;
     }
-    
-    // Create header
-    WavHeader header;
-    header.data_bytes = pcm_data.size() * sizeof(int16_t);
-    header.wav_size = header.data_bytes + sizeof(WavHeader) - 8;
-    
-    // Write to file
-    std::ofstream outfile(filename, std::ios::binary);
-    if (outfile.is_open()) {
-        outfile.write(reinterpret_cast<const char*>(&header), sizeof(WavHeader));
-        outfile.write(reinterpret_cast<const char*>(pcm_data.data()), header.data_bytes);
-        outfile.close();
+
+    void writeSamples(const float* samples, size_t count) {
+        if (!file.is_open() || count == 0) return;
+
+        // Reused scratch buffer: grows once to the largest drain size, then
+        // stays put
+        pcm.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            float clipped = std::max(-1.0f, std::min(1.0f, samples[i]));
+            pcm[i] = static_cast<int16_t>(clipped * 32767.0f);
+        }
+        file.write(reinterpret_cast<const char*>(pcm.data()), count * sizeof(int16_t));
+        dataBytes += count * sizeof(int16_t);
+    }
+
+    // Samples already in the output format go straight to disk
+    void writePcm(const int16_t* samples, size_t count) {
+        if (!file.is_open() || count == 0) return;
+        file.write(reinterpret_cast<const char*>(samples), count * sizeof(int16_t));
+        dataBytes += count * sizeof(int16_t);
+    }
+
+    void close() {
+        if (!file.is_open()) return;
+
+        if (dataBytes == 0) {
+            file.close();
+            std::remove(filename.c_str());
+            std::cout << "No audio data recorded" << std::endl;
+            return;
+        }
+
+        // Patch the sizes now that we know how much data was written
+        WavHeader header = makeHeader();
+        header.data_bytes = dataBytes;
+        header.wav_size = dataBytes + sizeof(WavHeader) - 8;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(WavHeader));
+        file.close();
         std::cout << "Audio saved to " << filename << std::endl;
-    } else {
+    }
+
+private:
+    WavHeader makeHeader() const {
+        WavHeader header;
+        header.sample_rate = sampleRate;
+        header.byte_rate = sampleRate * 2;
+        return header;
+    }
+
+    std::string filename;
+    std::ofstream file;
+    int sampleRate = 44100;
+    uint32_t dataBytes = 0;
+    std::vector<int16_t> pcm;
+};
+
+WavWriter WAV_WRITER;
+
+// ---- Mapped WAV export ----
+// The offline renderer knows its exact output size up front, so export
+// skips the intermediate int16 buffer and the ofstream traffic entirely:
+// ftruncate the file to final size, map it, and convert float samples to
+// int16 directly into the mapping in one pass. The streaming WavWriter
+// stays for the live capture path, whose length isn't known until exit.
+bool writeWavMapped(const std::string& filename, const float* samples,
+                    size_t count, int rate) {
+    size_t dataBytes = count * sizeof(int16_t);
+    size_t fileBytes = sizeof(WavHeader) + dataBytes;
+
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(fileBytes)) != 0) {
+        std::cerr << "ftruncate failed for " << filename << std::endl;
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "mmap failed for " << filename << std::endl;
+        return false;
+    }
+
+    WavHeader header;
+    header.sample_rate = rate;
+    header.byte_rate = rate * 2;
+    header.data_bytes = static_cast<uint32_t>(dataBytes);
+    header.wav_size = static_cast<uint32_t>(fileBytes - 8);
+    std::memcpy(map, &header, sizeof(WavHeader));
+
+    int16_t* out = reinterpret_cast<int16_t*>(
+        static_cast<char*>(map) + sizeof(WavHeader));
+    for (size_t i = 0; i < count; i++) {
+        float clipped = std::max(-1.0f, std::min(1.0f, samples[i]));
+        out[i] = static_cast<int16_t>(clipped * 32767.0f);
+    }
+
+    munmap(map, fileBytes);
+    std::cout << "Audio saved to " << filename << std::endl;
+    return true;
+}
+
+// ---- Capture resampler ----
+// Converts the device-rate capture stream to CAPTURE_RATE when they
+// differ: a 16-tap windowed-sinc kernel with 128 precomputed fractional
+// phases, run on the capture thread so the audio callback never pays for
+// it. Linear interpolation would image audibly on GB-style square edges;
+// the sinc keeps the capture clean, and downsampling lowers the cutoff
+// below the output Nyquist.
+class SincResampler {
+public:
+    void init(int inRate, int outRate) {
+        const double PI = 3.14159265358979323846;
+        step = static_cast<double>(inRate) / outRate;
+        double cutoff = std::min(1.0, static_cast<double>(outRate) / inRate);
+        for (int ph = 0; ph < PHASES; ph++) {
+            double frac = static_cast<double>(ph) / PHASES;
+            double sum = 0.0;
+            for (int t = 0; t < TAPS; t++) {
+                double x = (t - (TAPS / 2 - 1) - frac) * cutoff;
+                double sinc = (x == 0.0) ? 1.0 : std::sin(PI * x) / (PI * x);
+                double hann = 0.5 - 0.5 * std::cos(2.0 * PI * (t + 1) / (TAPS + 1));
+                table[ph][t] = static_cast<float>(sinc * cutoff * hann);
+                sum += table[ph][t];
+            }
+            // Normalize each phase so DC passes at exactly unity
+            for (int t = 0; t < TAPS; t++) {
+                table[ph][t] = static_cast<float>(table[ph][t] / sum);
+            }
+        }
     }
+
+    // Append in and emit however many output samples are now covered
+    void process(const std::vector<float>& in, std::vector<float>& out) {
+        buf.insert(buf.end(), in.begin(), in.end());
+        while (pos + TAPS <= static_cast<double>(buf.size())) {
+            size_t idx = static_cast<size_t>(pos);
+            int phase = static_cast<int>((pos - idx) * PHASES);
+            const float* h = table[phase];
+            float acc = 0.0f;
+            for (int t = 0; t < TAPS; t++) {
+                acc += buf[idx + t] * h[t];
+            }
+            out.push_back(acc);
+            pos += step;
+        }
+        size_t consumed = static_cast<size_t>(pos);
+        if (consumed > 0) {
+            buf.erase(buf.begin(), buf.begin() + consumed);
+            pos -= consumed;
+        }
+    }
+
+private:
+    static const int TAPS = 16;
+    static const int PHASES = 128;
+    float table[PHASES][TAPS];
+    std::vector<float> buf;
+    double pos = 0.0;
+    double step = 1.0;
+};
+
+SincResampler CAPTURE_RESAMPLER;
+
+// Write captured device-rate samples to the session WAV, resampling when
+// the capture rate differs. Called from the capture thread, and once more
+// from the main thread after that thread has joined. In the common
+// matched-rate case the int16 samples pass straight through; the
+// resampler path widens to float for the duration of the conversion
+void writeCapture(const std::vector<int16_t>& samples) {
+    if (CAPTURE_RATE == SAMPLE_RATE) {
+        WAV_WRITER.writePcm(samples.data(), samples.size());
+        return;
+    }
+    static std::vector<float> widened;
+    static std::vector<float> converted;
+    widened.clear();
+    converted.clear();
+    widened.reserve(samples.size());
+    for (int16_t s : samples) {
+        widened.push_back(s / 32767.0f);
+    }
+    CAPTURE_RESAMPLER.process(widened, converted);
+    WAV_WRITER.writeSamples(converted.data(), converted.size());
 }
 
 // Initialize piano keys
@@ -520,28 +1319,126 @@ void initPianoKeys() {
 }
 
 // Update piano key state based on keyboard input
-void updatePianoKeyState(SDL_Keycode keycode, bool isPressed) {
-    for (auto& key : pianoKeys) {
-        if (key.keycode == keycode) {
-            key.isActive = isPressed;
-            if (isPressed && !key.isBlack) {
-                currentFrequency = key.frequency;
-                currentChannel = key.channel;
-                isPlacingNote = true;
-            }
-            break;
+// ---- Flat scancode dispatch ----
+// One array indexed by SDL scancode replaces the per-event unordered_map
+// lookups (one per channel) and the linear pianoKeys walk: a key event
+// reads its {channel, frequency, piano key} in a single small load, so
+// key-to-sound dispatch is constant time.
+struct NoteDispatch {
+    uint8_t channel = 0;    // 0: this key makes no note
+    int16_t pianoKey = -1;  // index into pianoKeys; -1 for CH3/CH4 keys
+    float frequency = 0.0f;
+};
+NoteDispatch NOTE_DISPATCH[SDL_NUM_SCANCODES];
+
+// Build the dispatch table from the note maps; call after initPianoKeys
+void initNoteDispatch() {
+    auto fill = [](const std::unordered_map<SDL_Keycode, float>& notes,
+                   uint8_t channel) {
+        for (const auto& entry : notes) {
+            SDL_Scancode sc = SDL_GetScancodeFromKey(entry.first);
+            if (sc == SDL_SCANCODE_UNKNOWN || sc >= SDL_NUM_SCANCODES) continue;
+            NOTE_DISPATCH[sc].channel = channel;
+            NOTE_DISPATCH[sc].frequency = entry.second;
+        }
+    };
+    fill(CHANNEL1_NOTES, 1);
+    fill(CHANNEL2_NOTES, 2);
+    fill(CHANNEL3_NOTES, 3);
+    fill(CHANNEL4_NOTES, 4);
+
+    for (size_t k = 0; k < pianoKeys.size(); k++) {
+        SDL_Scancode sc = SDL_GetScancodeFromKey(pianoKeys[k].keycode);
+        if (sc == SDL_SCANCODE_UNKNOWN || sc >= SDL_NUM_SCANCODES) continue;
+        NOTE_DISPATCH[sc].pianoKey = static_cast<int16_t>(k);
+    }
+}
+
+// staffNotes is kept sorted by x at all times, so hit tests, the playback
+// window, and visibility culling are binary searches over a small window
+// instead of full scans — with thousands of notes the old linear walks
+// made every click and tick O(n)
+std::vector<StaffNote>::iterator firstNoteAtOrAfter(int x) {
+    return std::lower_bound(staffNotes.begin(), staffNotes.end(), x,
+                            [](const StaffNote& note, int value) {
+                                return note.x < value;
+                            });
+}
+
+// ---- Undo/redo ----
+// Staff edits append {kind, payload} commands to a log instead of
+// snapshotting the whole vector, so history costs O(1) memory per edit
+// and undoing is a single re-applied command rather than a bulk copy.
+// EDIT_CURSOR splits the log into applied commands [0, cursor) and the
+// redo tail; a fresh edit truncates the tail. Ctrl+Z / Ctrl+Y.
+struct EditCommand {
+    enum Kind { ADD, REMOVE, CLEAR };
+    Kind kind;
+    StaffNote note;                  // ADD / REMOVE payload
+    std::vector<StaffNote> cleared;  // CLEAR payload: the wiped staff
+};
+
+std::vector<EditCommand> EDIT_LOG;
+size_t EDIT_CURSOR = 0;
+
+void recordEdit(EditCommand&& cmd) {
+    EDIT_LOG.resize(EDIT_CURSOR);
+    EDIT_LOG.push_back(std::move(cmd));
+    EDIT_CURSOR = EDIT_LOG.size();
+}
+
+// Raw insert preserving x order; shared by edits and redo
+static void insertNoteSorted(const StaffNote& note) {
+    staffNotes.insert(firstNoteAtOrAfter(note.x), note);
+}
+
+// Erase the staff note matching a command payload
+static void eraseNoteMatching(const StaffNote& note) {
+    for (auto it = firstNoteAtOrAfter(note.x);
+         it != staffNotes.end() && it->x == note.x; ++it) {
+        if (it->frequency == note.frequency && it->channel == note.channel &&
+            it->position == note.position && it->type == note.type) {
+            staffNotes.erase(it);
+            return;
         }
     }
 }
 
-// Add a note to the staff
+void undoEdit() {
+    if (EDIT_CURSOR == 0) return;
+    const EditCommand& cmd = EDIT_LOG[--EDIT_CURSOR];
+    switch (cmd.kind) {
+        case EditCommand::ADD:    eraseNoteMatching(cmd.note); break;
+        case EditCommand::REMOVE: insertNoteSorted(cmd.note); break;
+        case EditCommand::CLEAR:  staffNotes = cmd.cleared; break;
+    }
+}
+
+void redoEdit() {
+    if (EDIT_CURSOR >= EDIT_LOG.size()) return;
+    const EditCommand& cmd = EDIT_LOG[EDIT_CURSOR++];
+    switch (cmd.kind) {
+        case EditCommand::ADD:    insertNoteSorted(cmd.note); break;
+        case EditCommand::REMOVE: eraseNoteMatching(cmd.note); break;
+        case EditCommand::CLEAR:  staffNotes.clear(); break;
+    }
+}
+
+// Add a note to the staff, preserving x order
 void addNoteToStaff(int x, float frequency, int channel) {
     if (frequency <= 0) return;
-    
+
     auto it = NOTE_POSITIONS.find(frequency);
     if (it != NOTE_POSITIONS.end()) {
         int position = it->second;
-        staffNotes.push_back({frequency, position, x + scrollOffset, channel, false, currentNoteType});
+        int noteX = x + scrollOffset;
+        StaffNote note = {frequency, position, noteX, channel, currentNoteType};
+        insertNoteSorted(note);
+
+        EditCommand cmd;
+        cmd.kind = EditCommand::ADD;
+        cmd.note = note;
+        recordEdit(std::move(cmd));
     }
 }
 
@@ -549,136 +1446,431 @@ void addNoteToStaff(int x, float frequency, int channel) {
 void removeNoteFromStaff(int x, int y) {
     int clickX = x + scrollOffset;
     int staffCenterY = STAFF_Y + STAFF_HEIGHT / 2;
-    
-    for (auto it = staffNotes.begin(); it != staffNotes.end(); ++it) {
+
+    // Only notes within the hit radius on x can match
+    auto it = firstNoteAtOrAfter(clickX - NOTE_RADIUS * 2 + 1);
+    for (; it != staffNotes.end() && it->x - clickX < NOTE_RADIUS * 2; ++it) {
         int noteY = staffCenterY - it->position * LINE_SPACING / 2;
-        if (abs(it->x - clickX) < NOTE_RADIUS * 2 && abs(y - noteY) < NOTE_RADIUS * 2) {
+        if (abs(y - noteY) < NOTE_RADIUS * 2) {
+            EditCommand cmd;
+            cmd.kind = EditCommand::REMOVE;
+            cmd.note = *it;
             staffNotes.erase(it);
+            recordEdit(std::move(cmd));
             break;
         }
     }
 }
 
-// Start playback of the staff notes
-void startPlayback() {
+// Wipe the staff, keeping the notes in the log so Ctrl+Z brings them back
+void clearStaff() {
     if (staffNotes.empty()) return;
-    
-    isPlayingSequence = true;
-    playbackPosition = scrollOffset;
-    
-    // Sort notes by x position for playback
-    std::sort(staffNotes.begin(), staffNotes.end(), 
-              [](const StaffNote& a, const StaffNote& b) { return a.x < b.x; });
-    
-    // Reset all notes to not playing
-    for (auto& note : staffNotes) {
-        note.isPlaying = false;
+
+    EditCommand cmd;
+    cmd.kind = EditCommand::CLEAR;
+    cmd.cleared = std::move(staffNotes);
+    staffNotes.clear();
+    recordEdit(std::move(cmd));
+    isPlayingSequence = false;
+}
+
+// ---- Project files ----
+// Compact binary format for compositions, struct-of-arrays so a load is a
+// handful of bulk copies straight out of a memory-mapped file instead of
+// per-note parsing. Layout after the header: the wave pattern, then one
+// packed array per note field (4-byte fields first so everything stays
+// aligned). Saved with S, loaded with O.
+struct ProjectHeader {
+    char magic[4] = {'G', 'B', 'C', 'P'};
+    uint32_t version = 1;
+    uint32_t noteCount = 0;
+    uint32_t wavePatternSize = 16;
+};
+
+void saveProject(const std::string& filename) {
+    uint32_t n = static_cast<uint32_t>(staffNotes.size());
+
+    // Transpose the notes into per-field arrays
+    std::vector<float> freqs(n);
+    std::vector<int32_t> positions(n);
+    std::vector<int32_t> xs(n);
+    std::vector<uint8_t> channels(n);
+    std::vector<uint8_t> types(n);
+    for (uint32_t i = 0; i < n; i++) {
+        freqs[i] = staffNotes[i].frequency;
+        positions[i] = staffNotes[i].position;
+        xs[i] = staffNotes[i].x;
+        channels[i] = static_cast<uint8_t>(staffNotes[i].channel);
+        types[i] = static_cast<uint8_t>(staffNotes[i].type);
     }
-    
-    // Clear the playback queue
-    playbackQueue.clear();
+
+    ProjectHeader header;
+    header.noteCount = n;
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        return;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    // Snapshot the atomic wave table into plain floats for the file
+    float wave[WAVE_SAMPLES];
+    for (int i = 0; i < WAVE_SAMPLES; i++) {
+        wave[i] = WAVE_PATTERN[i].load(std::memory_order_relaxed);
+    }
+    out.write(reinterpret_cast<const char*>(wave),
+              header.wavePatternSize * sizeof(float));
+    out.write(reinterpret_cast<const char*>(freqs.data()), n * sizeof(float));
+    out.write(reinterpret_cast<const char*>(positions.data()), n * sizeof(int32_t));
+    out.write(reinterpret_cast<const char*>(xs.data()), n * sizeof(int32_t));
+    out.write(reinterpret_cast<const char*>(channels.data()), n * sizeof(uint8_t));
+    out.write(reinterpret_cast<const char*>(types.data()), n * sizeof(uint8_t));
+    out.close();
+    std::cout << "Project saved to " << filename << " (" << n << " notes)" << std::endl;
 }
 
-// Update playback state
-void updatePlayback() {
+bool loadProject(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open project: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ProjectHeader)) {
+        std::cerr << "Not a project file: " << filename << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // Map the whole file; the kernel pages it in on demand, so even a huge
+    // project "opens" immediately
+    size_t size = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "mmap failed for " << filename << std::endl;
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(map);
+    ProjectHeader header;
+    std::memcpy(&header, base, sizeof(header));
+
+    uint32_t n = header.noteCount;
+    size_t expected = sizeof(ProjectHeader) +
+                      header.wavePatternSize * sizeof(float) +
+                      n * (sizeof(float) + 2 * sizeof(int32_t) + 2 * sizeof(uint8_t));
+    if (std::memcmp(header.magic, "GBCP", 4) != 0 || header.version != 1 ||
+        header.wavePatternSize != 16 || size < expected) {
+        std::cerr << "Not a project file: " << filename << std::endl;
+        munmap(map, size);
+        return false;
+    }
+
+    const char* p = base + sizeof(ProjectHeader);
+    const float* wave = reinterpret_cast<const float*>(p);
+    p += header.wavePatternSize * sizeof(float);
+    const float* freqs = reinterpret_cast<const float*>(p);
+    p += n * sizeof(float);
+    const int32_t* positions = reinterpret_cast<const int32_t*>(p);
+    p += n * sizeof(int32_t);
+    const int32_t* xs = reinterpret_cast<const int32_t*>(p);
+    p += n * sizeof(int32_t);
+    const uint8_t* channels = reinterpret_cast<const uint8_t*>(p);
+    p += n * sizeof(uint8_t);
+    const uint8_t* types = reinterpret_cast<const uint8_t*>(p);
+
+    // Re-quantize through the editor path so WAVE_LEVELS matches what the
+    // file carried (old projects saved un-quantized floats)
+    for (uint32_t i = 0; i < header.wavePatternSize; i++) {
+        setWaveLevel(i, static_cast<int>(std::lround((wave[i] + 1.0f) * 7.5f)));
+    }
+
+    // One allocation for the whole staff, then field-wise fills. The
+    // header checks above only prove the file's shape, not its contents;
+    // notes with a channel or frequency the synth can't play are dropped
+    // here rather than handed to the callback. On channel 4 the field is
+    // an LFSR shift rate, not a pitch, so its ceiling is the 32768Hz
+    // hi-hat rate rather than the audible range
+    staffNotes.clear();
+    staffNotes.reserve(n);
+    uint32_t dropped = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        float maxFreq = (channels[i] == 4) ? 32768.0f : 20000.0f;
+        if (channels[i] < 1 || channels[i] > 4 ||
+            !std::isfinite(freqs[i]) || freqs[i] < 1.0f || freqs[i] > maxFreq) {
+            dropped++;
+            continue;
+        }
+        StaffNote note;
+        note.frequency = freqs[i];
+        note.position = positions[i];
+        note.x = xs[i];
+        note.channel = channels[i];
+        note.type = static_cast<NoteType>(types[i]);
+        staffNotes.push_back(note);
+    }
+    if (dropped > 0) {
+        std::cerr << "Dropped " << dropped << " out-of-range notes from "
+                  << filename << std::endl;
+    }
+
+    // Every staff query binary-searches on x, so restore the sorted
+    // invariant — our own saves are already ordered, but the file may
+    // not be ours. stable_sort keeps same-x notes in file order, like
+    // placing them by hand would
+    if (!std::is_sorted(staffNotes.begin(), staffNotes.end(),
+                        [](const StaffNote& a, const StaffNote& b) {
+                            return a.x < b.x;
+                        })) {
+        std::stable_sort(staffNotes.begin(), staffNotes.end(),
+                         [](const StaffNote& a, const StaffNote& b) {
+                             return a.x < b.x;
+                         });
+    }
+
+    munmap(map, size);
+    isPlayingSequence = false;
+    // Edit history refers to the staff that was just replaced
+    EDIT_LOG.clear();
+    EDIT_CURSOR = 0;
+    std::cout << "Project loaded from " << filename << " ("
+              << staffNotes.size() << " notes)" << std::endl;
+    return true;
+}
+
+// How long a placed note sounds for
+float noteDurationSeconds(const StaffNote& note) {
+    return (note.type == QUARTER_NOTE) ? EIGHTH_NOTE_SECONDS * 2.0f
+                                       : EIGHTH_NOTE_SECONDS;
+}
+
+// Compile the staff into a sample-accurate event list, starting at the
+// current scroll position. Returns nullptr if there is nothing to play.
+Sequence* compileStaff() {
+    Sequence* seq = new Sequence();
+    for (auto it = firstNoteAtOrAfter(scrollOffset); it != staffNotes.end(); ++it) {
+        const StaffNote& note = *it;
+
+        uint64_t start = static_cast<uint64_t>(note.x - scrollOffset) *
+                         SAMPLE_RATE / PLAYBACK_PX_PER_SEC;
+        uint64_t end = start + static_cast<uint64_t>(
+                           noteDurationSeconds(note) * SAMPLE_RATE);
+
+        seq->events.push_back({start, note.channel, note.frequency, true});
+        seq->events.push_back({end, note.channel, note.frequency, false});
+        seq->endSample = std::max(seq->endSample, end);
+    }
+
+    if (seq->events.empty()) {
+        delete seq;
+        return nullptr;
+    }
+
+    // Time order; at the same sample, note-offs go first so a new note-on
+    // on the same channel isn't cut by the previous note's release
+    std::sort(seq->events.begin(), seq->events.end(),
+              [](const SeqEvent& a, const SeqEvent& b) {
+                  if (a.sampleTime != b.sampleTime) return a.sampleTime < b.sampleTime;
+                  return !a.isOn && b.isOn;
+              });
+
+    return seq;
+}
+
+// Compile the staff and hand it to the audio callback
+void startPlayback() {
+    if (staffNotes.empty()) return;
+
+    // Free the sequence the audio thread retired last time around
+    delete SEQ_RETIRED.exchange(nullptr);
+
+    Sequence* seq = compileStaff();
+    if (!seq) return;
+
+    isPlayingSequence = true;
+    playbackPosition = scrollOffset;
+
+    // Hand over to the audio thread; if it never consumed the previous
+    // pending sequence, reclaim it here
+    delete SEQ_PENDING.exchange(seq);
+}
+
+// Mirror the audio-thread sequencer for drawing: the red playback line and
+// the note highlights are derived from the sample clock, not a UI timer
+void updatePlayback() {
     if (!isPlayingSequence) return;
-    
-    // Check if we've reached the end of the staff
-    if (playbackPosition > STAFF_WIDTH + scrollOffset) {
+
+    // A still-published sequence hasn't been adopted yet — the callback
+    // only flips SEQ_ACTIVE when it picks the pointer up, which can be a
+    // whole audio block after startPlayback. Don't read the false as
+    // "playback ended" and kill the mirror before it starts
+    if (SEQ_PENDING.load(std::memory_order_acquire) != nullptr) return;
+
+    if (!SEQ_ACTIVE) {
         isPlayingSequence = false;
-        
-        // Stop all sound
-        {
-            std::lock_guard<std::mutex> lock1(CH1.lock);
-            CH1.active = false;
-        }
-        {
-            std::lock_guard<std::mutex> lock2(CH2.lock);
-            CH2.active = false;
-        }
-        {
-            std::lock_guard<std::mutex> lock3(CH3.lock);
-            CH3.active = false;
-        }
+        needsRedraw = true;
         return;
     }
-    
-    // Check for notes at the current position
-    for (auto& note : staffNotes) {
-        if (abs(note.x - playbackPosition) < 5 && !note.isPlaying) {
-            // Add to playback queue
-            playbackQueue.push_back(note);
-            note.isPlaying = true;
-        }
+
+    uint64_t pos = SEQ_SAMPLE.load(std::memory_order_acquire);
+    int newPosition = scrollOffset +
+                      static_cast<int>(pos * PLAYBACK_PX_PER_SEC / SAMPLE_RATE);
+    if (newPosition != playbackPosition) {
+        playbackPosition = newPosition;
+        needsRedraw = true;
     }
-    
-    // Process playback queue
-    if (!playbackQueue.empty()) {
-        StaffNote& note = playbackQueue.front();
-        
-        // Play the note
-        if (note.channel == 1) {
-            std::lock_guard<std::mutex> lock(CH1.lock);
-            CH1.active = true;
-            CH1.frequency = note.frequency;
-        } else if (note.channel == 2) {
-            std::lock_guard<std::mutex> lock(CH2.lock);
-            CH2.active = true;
-            CH2.frequency = note.frequency;
-        } else if (note.channel == 3) {
-            std::lock_guard<std::mutex> lock(CH3.lock);
-            CH3.active = true;
-            CH3.frequency = note.frequency;
-        }
-        
-        // For quarter notes, we'll keep them in the queue longer
-        if (note.type == EIGHTH_NOTE || playbackQueue.size() > 4) {
-            playbackQueue.pop_front();
-        } else {
-            // Move to the back of the queue to extend play time for quarter notes
-            StaffNote quarterNote = playbackQueue.front();
-            playbackQueue.pop_front();
-            playbackQueue.push_back(quarterNote);
+}
+
+// Whether the playback cursor is currently inside this note — computed at
+// draw time from the mirrored sample clock, so playback never writes
+// per-note state for the renderer to read
+bool notePlayingNow(const StaffNote& note) {
+    if (!isPlayingSequence) return false;
+    int durPx = static_cast<int>(noteDurationSeconds(note) * PLAYBACK_PX_PER_SEC);
+    return playbackPosition >= note.x && playbackPosition < note.x + durPx;
+}
+
+// ---- Note glyph atlas ----
+// renderStaff used to draw every note head pixel-by-pixel with nested
+// SDL_RenderDrawPoint loops — roughly 200 draw calls per note, repeated
+// for fills, quarter-note holes, and highlight rings, every frame. The
+// shapes are rendered once at startup into a small texture atlas and then
+// blitted with one SDL_RenderCopy per note. The atlas is white; channel
+// colors and ghost transparency are applied with color/alpha mods.
+const int GLYPH_CELL = 24;
+enum GlyphIndex {
+    GLYPH_HEAD = 0,         // filled note head
+    GLYPH_HEAD_HOLLOW = 1,  // quarter-note outline
+    GLYPH_RING = 2,         // playing-highlight ring
+    GLYPH_COUNT = 3
+};
+SDL_Texture* NOTE_ATLAS = nullptr;
+
+void initNoteAtlas(SDL_Renderer* renderer) {
+    NOTE_ATLAS = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                   SDL_TEXTUREACCESS_TARGET,
+                                   GLYPH_CELL * GLYPH_COUNT, GLYPH_CELL);
+    if (!NOTE_ATLAS) return;
+    SDL_SetTextureBlendMode(NOTE_ATLAS, SDL_BLENDMODE_BLEND);
+
+    SDL_SetRenderTarget(renderer, NOTE_ATLAS);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+    SDL_RenderClear(renderer);
+
+    // The one-time pixel loops; after this everything is RenderCopy
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    int c = GLYPH_CELL / 2;
+    for (int dy = -NOTE_RADIUS - 2; dy <= NOTE_RADIUS + 2; dy++) {
+        for (int dx = -NOTE_RADIUS - 2; dx <= NOTE_RADIUS + 2; dx++) {
+            int d2 = dx * dx + dy * dy;
+
+            // Filled head
+            if (d2 <= NOTE_RADIUS * NOTE_RADIUS) {
+                SDL_RenderDrawPoint(renderer, c + dx, c + dy);
+            }
+            // Hollow head: the filled shape minus the old white hole
+            if (d2 <= NOTE_RADIUS * NOTE_RADIUS &&
+                d2 > (NOTE_RADIUS - 2) * (NOTE_RADIUS - 2)) {
+                SDL_RenderDrawPoint(renderer, GLYPH_CELL + c + dx, c + dy);
+            }
+            // Highlight ring just outside the head
+            if (d2 <= (NOTE_RADIUS + 2) * (NOTE_RADIUS + 2) &&
+                d2 > NOTE_RADIUS * NOTE_RADIUS) {
+                SDL_RenderDrawPoint(renderer, 2 * GLYPH_CELL + c + dx, c + dy);
+            }
         }
     }
-    
-    // Advance playback position
-    playbackPosition += 2;
+
+    SDL_SetRenderTarget(renderer, nullptr);
 }
 
-// Render the piano keyboard
-void renderPiano(SDL_Renderer* renderer) {
-    // First draw all white keys
-    for (const auto& key : pianoKeys) {
-        if (!key.isBlack) {
-            SDL_SetRenderDrawColor(
-                renderer,
-                key.isActive ? key.activeColor.r : key.color.r,
-                key.isActive ? key.activeColor.g : key.color.g,
-                key.isActive ? key.activeColor.b : key.color.b,
-                key.isActive ? key.activeColor.a : key.color.a
-            );
-            SDL_RenderFillRect(renderer, &key.rect);
-            
-            // Draw border
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            SDL_RenderDrawRect(renderer, &key.rect);
-        }
+// Blit one glyph centered at (x, y) in the given color
+void drawGlyph(SDL_Renderer* renderer, GlyphIndex glyph, int x, int y,
+               Uint8 r, Uint8 g, Uint8 b, Uint8 alpha = 255) {
+    SDL_Rect src = {glyph * GLYPH_CELL, 0, GLYPH_CELL, GLYPH_CELL};
+    SDL_Rect dst = {x - GLYPH_CELL / 2, y - GLYPH_CELL / 2, GLYPH_CELL, GLYPH_CELL};
+    SDL_SetTextureColorMod(NOTE_ATLAS, r, g, b);
+    SDL_SetTextureAlphaMod(NOTE_ATLAS, alpha);
+    SDL_RenderCopy(renderer, NOTE_ATLAS, &src, &dst);
+}
+
+// ---- Batched piano geometry ----
+// The keyboard layout never changes, so every key is baked into one
+// vertex/index buffer at startup and the whole keyboard is drawn with a
+// single SDL_RenderGeometry call instead of two or three rect calls per
+// key. Per frame only the fill colors are retinted from isActive. Quad
+// order gives the layering: white-key borders, white-key fills, then
+// black keys on top.
+std::vector<SDL_Vertex> PIANO_VERTS;
+std::vector<int> PIANO_INDICES;
+
+// Fill quads whose color tracks a key's isActive state
+struct PianoFillQuad {
+    size_t firstVert;
+    size_t keyIndex;
+};
+std::vector<PianoFillQuad> PIANO_FILL_QUADS;
+
+// Append one solid quad (two triangles) for the rect
+static size_t pushPianoQuad(const SDL_Rect& r, SDL_Color color) {
+    size_t base = PIANO_VERTS.size();
+    SDL_Vertex v;
+    v.color = color;
+    v.tex_coord = {0.0f, 0.0f};
+
+    v.position = {static_cast<float>(r.x), static_cast<float>(r.y)};
+    PIANO_VERTS.push_back(v);
+    v.position = {static_cast<float>(r.x + r.w), static_cast<float>(r.y)};
+    PIANO_VERTS.push_back(v);
+    v.position = {static_cast<float>(r.x + r.w), static_cast<float>(r.y + r.h)};
+    PIANO_VERTS.push_back(v);
+    v.position = {static_cast<float>(r.x), static_cast<float>(r.y + r.h)};
+    PIANO_VERTS.push_back(v);
+
+    int b = static_cast<int>(base);
+    PIANO_INDICES.insert(PIANO_INDICES.end(), {b, b + 1, b + 2, b, b + 2, b + 3});
+    return base;
+}
+
+// Build the keyboard's vertex buffer; call once after initPianoKeys
+void initPianoGeometry() {
+    const SDL_Color border = {0, 0, 0, 255};
+
+    // White keys: a full-rect black quad gives the 1px border, the fill
+    // sits inset on top of it
+    for (size_t k = 0; k < pianoKeys.size(); k++) {
+        const PianoKey& key = pianoKeys[k];
+        if (key.isBlack) continue;
+        pushPianoQuad(key.rect, border);
+        SDL_Rect inner = {key.rect.x + 1, key.rect.y + 1,
+                          key.rect.w - 2, key.rect.h - 2};
+        PIANO_FILL_QUADS.push_back({pushPianoQuad(inner, key.color), k});
     }
-    
-    // Then draw all black keys (so they appear on top)
-    for (const auto& key : pianoKeys) {
-        if (key.isBlack) {
-            SDL_SetRenderDrawColor(
-                renderer,
-                key.isActive ? key.activeColor.r : key.color.r,
-                key.isActive ? key.activeColor.g : key.color.g,
-                key.isActive ? key.activeColor.b : key.color.b,
-                key.isActive ? key.activeColor.a : key.color.a
-            );
-            SDL_RenderFillRect(renderer, &key.rect);
+
+    // Black keys last so they draw over the white keys
+    for (size_t k = 0; k < pianoKeys.size(); k++) {
+        const PianoKey& key = pianoKeys[k];
+        if (!key.isBlack) continue;
+        PIANO_FILL_QUADS.push_back({pushPianoQuad(key.rect, key.color), k});
+    }
+}
+
+// Render the piano keyboard: retint the active keys, one draw call
+void renderPiano(SDL_Renderer* renderer) {
+    for (const auto& quad : PIANO_FILL_QUADS) {
+        const PianoKey& key = pianoKeys[quad.keyIndex];
+        SDL_Color c = key.isActive ? key.activeColor : key.color;
+        for (size_t i = 0; i < 4; i++) {
+            PIANO_VERTS[quad.firstVert + i].color = c;
         }
     }
+
+    SDL_RenderGeometry(renderer, nullptr,
+                       PIANO_VERTS.data(), static_cast<int>(PIANO_VERTS.size()),
+                       PIANO_INDICES.data(), static_cast<int>(PIANO_INDICES.size()));
 }
 
 // Render the musical staff
@@ -705,35 +1897,37 @@ void renderStaff(SDL_Renderer* renderer) {
         SDL_RenderDrawLine(renderer, x, STAFF_Y, x, STAFF_Y + STAFF_HEIGHT);
     }
     
-    // Draw notes
-    for (const auto& note : staffNotes) {
+    // Draw notes; the sorted vector lets us jump to the first visible note
+    // and stop at the right edge instead of testing every note
+    auto first = firstNoteAtOrAfter(scrollOffset - NOTE_RADIUS);
+    for (auto it = first; it != staffNotes.end(); ++it) {
+        const StaffNote& note = *it;
+        if (note.x - scrollOffset > STAFF_WIDTH + NOTE_RADIUS) {
+            break;
+        }
+
         int x = STAFF_X + (note.x - scrollOffset);
         int y = centerY - note.position * LINE_SPACING / 2;
-        
-        // Skip notes outside the visible area
-        if (x < STAFF_X - NOTE_RADIUS || x > STAFF_X + STAFF_WIDTH + NOTE_RADIUS) {
-            continue;
-        }
-        
-        // Draw note circle with color based on channel
+
+        // Note color based on channel
+        Uint8 r, g, b;
         if (note.channel == 1) {
-            SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);  // Blue for pulse 1
+            r = 0; g = 0; b = 255;        // Blue for pulse 1
         } else if (note.channel == 2) {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);  // Red for pulse 2
+            r = 255; g = 0; b = 0;        // Red for pulse 2
+        } else if (note.channel == 3) {
+            r = 0; g = 180; b = 0;        // Green for wave
         } else {
-            SDL_SetRenderDrawColor(renderer, 0, 180, 0, 255);  // Green for wave
+            r = 100; g = 100; b = 100;    // Gray for noise
         }
-        
-        // Draw filled circle for the note
-        for (int dy = -NOTE_RADIUS; dy <= NOTE_RADIUS; dy++) {
-            for (int dx = -NOTE_RADIUS; dx <= NOTE_RADIUS; dx++) {
-                if (dx*dx + dy*dy <= NOTE_RADIUS*NOTE_RADIUS) {
-                    SDL_RenderDrawPoint(renderer, x + dx, y + dy);
-                }
-            }
-        }
-        
+
+        // Head: filled for eighth notes, hollow for quarter notes
+        drawGlyph(renderer,
+                  note.type == QUARTER_NOTE ? GLYPH_HEAD_HOLLOW : GLYPH_HEAD,
+                  x, y, r, g, b);
+
         // Draw stem
+        SDL_SetRenderDrawColor(renderer, r, g, b, 255);
         if (note.position >= 0) {
             // Stem down for higher notes
             SDL_RenderDrawLine(renderer, x + NOTE_RADIUS, y, x + NOTE_RADIUS, y + 30);
@@ -741,31 +1935,10 @@ void renderStaff(SDL_Renderer* renderer) {
             // Stem up for lower notes
             SDL_RenderDrawLine(renderer, x - NOTE_RADIUS, y, x - NOTE_RADIUS, y - 30);
         }
-    
-        // Draw note head based on type
-        if (note.type == QUARTER_NOTE) {
-            // For quarter notes, draw an empty circle
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            for (int dy = -NOTE_RADIUS+2; dy <= NOTE_RADIUS-2; dy++) {
-                for (int dx = -NOTE_RADIUS+2; dx <= NOTE_RADIUS-2; dx++) {
-                    if (dx*dx + dy*dy <= (NOTE_RADIUS-2)*(NOTE_RADIUS-2)) {
-                        SDL_RenderDrawPoint(renderer, x + dx, y + dy);
-                    }
-                }
-            }
-        }
-        
-        // Highlight if playing
-        if (note.isPlaying) {
-            SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
-            for (int dy = -NOTE_RADIUS-2; dy <= NOTE_RADIUS+2; dy++) {
-                for (int dx = -NOTE_RADIUS-2; dx <= NOTE_RADIUS+2; dx++) {
-                    if (dx*dx + dy*dy <= (NOTE_RADIUS+2)*(NOTE_RADIUS+2) && 
-                        dx*dx + dy*dy > NOTE_RADIUS*NOTE_RADIUS) {
-                        SDL_RenderDrawPoint(renderer, x + dx, y + dy);
-                    }
-                }
-            }
+
+        // Highlight if the playback cursor is inside the note
+        if (notePlayingNow(note)) {
+            drawGlyph(renderer, GLYPH_RING, x, y, 255, 255, 0);
         }
     }
     
@@ -783,20 +1956,15 @@ void renderStaff(SDL_Renderer* renderer) {
             // Constrain to staff area
             mouseX = std::max(STAFF_X, std::min(STAFF_X + STAFF_WIDTH, mouseX));
             
-            // Draw ghost note
+            // Draw ghost note at half alpha
             if (currentChannel == 1) {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 255, 128);
+                drawGlyph(renderer, GLYPH_HEAD, mouseX, y, 0, 0, 255, 128);
+            } else if (currentChannel == 2) {
+                drawGlyph(renderer, GLYPH_HEAD, mouseX, y, 255, 0, 0, 128);
+            } else if (currentChannel == 3) {
+                drawGlyph(renderer, GLYPH_HEAD, mouseX, y, 0, 180, 0, 128);
             } else {
-                SDL_SetRenderDrawColor(renderer, 255, 0, 0, 128);
-            }
-            
-            // Draw filled circle for the note
-            for (int dy = -NOTE_RADIUS; dy <= NOTE_RADIUS; dy++) {
-                for (int dx = -NOTE_RADIUS; dx <= NOTE_RADIUS; dx++) {
-                    if (dx*dx + dy*dy <= NOTE_RADIUS*NOTE_RADIUS) {
-                        SDL_RenderDrawPoint(renderer, mouseX + dx, y + dy);
-                    }
-                }
+                drawGlyph(renderer, GLYPH_HEAD, mouseX, y, 100, 100, 100, 128);
             }
         }
     }
@@ -830,6 +1998,64 @@ void renderStaff(SDL_Renderer* renderer) {
     SDL_RenderDrawRect(renderer, &rightScroll);
 }
 
+// UI-thread frame-time tracking; feeds the stats line and the HUD
+float LAST_FRAME_MS = 0.0f;
+float PEAK_FRAME_MS = 0.0f;
+
+// One horizontal HUD meter: gray track, colored fill clamped to the track
+static void drawPerfBar(SDL_Renderer* renderer, int x, int y, int w,
+                        float fill, Uint8 r, Uint8 g, Uint8 b) {
+    SDL_Rect track = {x, y, w, 8};
+    SDL_SetRenderDrawColor(renderer, 60, 60, 60, 255);
+    SDL_RenderFillRect(renderer, &track);
+
+    int fillW = static_cast<int>(w * std::max(0.0f, std::min(1.0f, fill)));
+    if (fillW > 0) {
+        SDL_Rect bar = {x, y, fillW, 8};
+        SDL_SetRenderDrawColor(renderer, r, g, b, 255);
+        SDL_RenderFillRect(renderer, &bar);
+    }
+}
+
+// Perf HUD (F1). There is no text rendering in this app, so the numbers
+// are shown as bar meters instead: avg/max/p99 callback time against the
+// buffer budget, stream CPU load, and UI frame time against 60fps. The
+// strip below the bars turns red while xruns have been counted; the exact
+// figures go to the periodic stdout stats line.
+void drawPerfHud(SDL_Renderer* renderer) {
+    const int hudX = 10, hudY = 10, barW = 150;
+
+    SDL_Rect panel = {hudX - 4, hudY - 4, barW + 8, 68};
+    SDL_SetRenderDrawColor(renderer, 30, 30, 30, 255);
+    SDL_RenderFillRect(renderer, &panel);
+
+    // Real-time budget for one callback of the stream's buffer size
+    const float budgetUs = static_cast<float>(FRAMES_PER_BUFFER) * 1e6f / SAMPLE_RATE;
+
+    uint64_t count = PERF.callbackCount.load(std::memory_order_relaxed);
+    uint64_t totalUs = PERF.callbackTotalUs.load(std::memory_order_relaxed);
+    float avgUs = count ? static_cast<float>(totalUs) / count : 0.0f;
+    float maxUs = PERF.callbackMaxUs.load(std::memory_order_relaxed);
+    float p99Us = PERF.percentileUs(0.99);
+    float cpuLoad = AUDIO_STREAM
+                        ? static_cast<float>(Pa_GetStreamCpuLoad(AUDIO_STREAM))
+                        : 0.0f;
+
+    drawPerfBar(renderer, hudX, hudY, barW, avgUs / budgetUs, 100, 220, 100);
+    drawPerfBar(renderer, hudX, hudY + 12, barW, maxUs / budgetUs, 220, 180, 80);
+    drawPerfBar(renderer, hudX, hudY + 24, barW, p99Us / budgetUs, 220, 180, 80);
+    drawPerfBar(renderer, hudX, hudY + 36, barW, cpuLoad, 100, 160, 220);
+    drawPerfBar(renderer, hudX, hudY + 48, barW, LAST_FRAME_MS / 16.7f, 180, 120, 220);
+
+    SDL_Rect xrunStrip = {hudX, hudY + 58, barW, 2};
+    if (PERF.xruns.load(std::memory_order_relaxed) > 0) {
+        SDL_SetRenderDrawColor(renderer, 255, 60, 60, 255);
+    } else {
+        SDL_SetRenderDrawColor(renderer, 80, 80, 80, 255);
+    }
+    SDL_RenderFillRect(renderer, &xrunStrip);
+}
+
 // Render UI elements
 void renderUI(SDL_Renderer* renderer) {
     // Draw channel selection indicator
@@ -839,8 +2065,10 @@ void renderUI(SDL_Renderer* renderer) {
         SDL_SetRenderDrawColor(renderer, 200, 200, 255, 255);  // Light blue for pulse 1
     } else if (currentChannel == 2) {
         SDL_SetRenderDrawColor(renderer, 255, 200, 200, 255);  // Light red for pulse 2
-    } else {
+    } else if (currentChannel == 3) {
         SDL_SetRenderDrawColor(renderer, 200, 255, 200, 255);  // Light green for wave
+    } else {
+        SDL_SetRenderDrawColor(renderer, 200, 200, 200, 255);  // Light gray for noise
     }
     
     SDL_RenderFillRect(renderer, &channelRect);
@@ -859,13 +2087,376 @@ void renderUI(SDL_Renderer* renderer) {
     SDL_RenderFillRect(renderer, &noteTypeRect);
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderDrawRect(renderer, &noteTypeRect);
-    
+
+    // Draw the CH3 wavetable editor: one bar per 4-bit sample, growing
+    // up from the panel floor. Click or drag inside to redraw the wave
+    SDL_Rect wavePanel = {WAVE_EDITOR_X, WAVE_EDITOR_Y,
+                          WAVE_SAMPLES * WAVE_EDITOR_COL, 16 * WAVE_EDITOR_STEP};
+    SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
+    SDL_RenderFillRect(renderer, &wavePanel);
+    SDL_SetRenderDrawColor(renderer, 100, 200, 100, 255);
+    for (int i = 0; i < WAVE_SAMPLES; i++) {
+        int barHeight = (WAVE_LEVELS[i] + 1) * WAVE_EDITOR_STEP;
+        SDL_Rect bar = {WAVE_EDITOR_X + i * WAVE_EDITOR_COL + 1,
+                        WAVE_EDITOR_Y + wavePanel.h - barHeight,
+                        WAVE_EDITOR_COL - 2, barHeight};
+        SDL_RenderFillRect(renderer, &bar);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderDrawRect(renderer, &wavePanel);
+
+
     // Draw instructions
     SDL_Rect instructRect = {50, WINDOW_HEIGHT - 60, WINDOW_WIDTH - 100, 50};
     SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
     SDL_RenderFillRect(renderer, &instructRect);
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderDrawRect(renderer, &instructRect);
+
+    if (showPerfHud) {
+        drawPerfHud(renderer);
+    }
+}
+
+// Block synthesis kernel for the pulse channels: a table-lookup oscillator
+// over the band-limited mip tables. Phase is 32-bit fixed point (one full
+// uint32_t turn per cycle): wrap is free integer overflow, the table index
+// is the top bits, and phase stays exact over arbitrarily long notes. The
+// SSE2 path advances four phases per integer add and shifts out four
+// indices at once; SSE2 has no gather, so the four table reads themselves
+// stay scalar.
+static void renderPulseBlock(ChannelState& ch, float frequency, int duty,
+                             float gain, float* out, unsigned long frames) {
+    const float* table = pulseTableFor(duty, frequency);
+    const float amp = AMPLITUDE * gain;
+    uint32_t inc = static_cast<uint32_t>(
+        frequency / SAMPLE_RATE * 4294967296.0);
+    uint32_t phase = ch.phase;
+    unsigned long i = 0;
+
+#if defined(__SSE2__)
+    if (frames >= 4) {
+        // Four consecutive phases per vector; lane overflow is the wrap
+        __m128i vphase = _mm_setr_epi32(static_cast<int32_t>(phase),
+                                        static_cast<int32_t>(phase + inc),
+                                        static_cast<int32_t>(phase + 2 * inc),
+                                        static_cast<int32_t>(phase + 3 * inc));
+        const __m128i vinc = _mm_set1_epi32(static_cast<int32_t>(4 * inc));
+
+        for (; i + 4 <= frames; i += 4) {
+            // All four table indices in one shift
+            __m128i idx = _mm_srli_epi32(vphase, 32 - WAVETABLE_BITS);
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), idx);
+
+            __m128 value = _mm_setr_ps(table[lanes[0]],
+                                       table[lanes[1]],
+                                       table[lanes[2]],
+                                       table[lanes[3]]);
+            value = _mm_mul_ps(value, _mm_set1_ps(amp));
+
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), value));
+            vphase = _mm_add_epi32(vphase, vinc);
+        }
+
+        phase += static_cast<uint32_t>(i) * inc;
+    }
+#endif
+
+    // Scalar fallback and vector tail
+    for (; i < frames; i++) {
+        out[i] += table[phase >> (32 - WAVETABLE_BITS)] * amp;
+        phase += inc;
+    }
+
+    ch.phase = phase;
+}
+
+// Mix every active voice in a pool into out for the given number of
+// frames. channelFilter narrows rendering to one channel (0 = all); the
+// mix workers use it to split the pool across threads
+static void renderPool(Voice* pool, float* out, unsigned long frames,
+                       int channelFilter = 0) {
+    for (int vi = 0; vi < MAX_VOICES; vi++) {
+        Voice& v = pool[vi];
+        int channel = v.channel.load(std::memory_order_acquire);
+        if (channel == 0) continue;
+        if (channelFilter != 0 && channel != channelFilter) continue;
+
+        ChannelState::Params p = v.state.load();
+        if (!p.active || p.frequency <= 0) continue;
+
+        // The frame sequencer maintains the envelope level between blocks;
+        // within a block it is a constant gain folded into the amplitude,
+        // so the per-sample cost is zero. The wave channel has no envelope
+        float envGain = 1.0f;
+        if (v.envPeriod > 0 && channel != 3) {
+            envGain = v.envLevel / 15.0f;
+        }
+
+        if (channel == 1 || channel == 2) {
+            // Pulse wave
+            renderPulseBlock(v.state, p.frequency, v.duty, envGain, out, frames);
+        } else if (channel == 3) {
+            // Wave channel: the 16-entry waveform index is the top four
+            // bits of the fixed-point phase, and the low 28 bits become
+            // the lerp fraction between that sample and the next. Two
+            // reads and a lerp per sample, and the quantized 4-bit steps
+            // stop sounding like a zipper at low frequencies
+            uint32_t inc = static_cast<uint32_t>(
+                p.frequency / SAMPLE_RATE * 4294967296.0);
+            for (unsigned long i = 0; i < frames; i++) {
+                uint32_t ph = v.state.phase;
+                uint32_t idx = ph >> 28;
+                float frac = (ph & 0x0FFFFFFF) * (1.0f / 268435456.0f);
+                float a = WAVE_PATTERN[idx].load(std::memory_order_relaxed);
+                float b = WAVE_PATTERN[(idx + 1) & (WAVE_SAMPLES - 1)]
+                              .load(std::memory_order_relaxed);
+                out[i] += (a + (b - a) * frac) * AMPLITUDE * 0.5f; // Slightly quieter
+                v.state.phase += inc;
+            }
+        } else {
+            // Noise: LFSR clock period in output samples. The active
+            // guard above only rejects frequency <= 0; a frequency below
+            // 1Hz (possible from a project file) would truncate to a
+            // zero divisor, so clamp before dividing
+            int shiftRate = static_cast<int>(p.frequency);
+            if (shiftRate < 1) shiftRate = 1;
+            int period = SAMPLE_RATE / shiftRate;
+            if (period < 1) period = 1;
+            bool sevenBit = NOISE_SEVEN_BIT.load(std::memory_order_relaxed);
+            float amp = AMPLITUDE * 0.5f * envGain;
+
+            for (unsigned long i = 0; i < frames; i++) {
+                if (--v.divider <= 0) {
+                    v.divider = period;
+                    // GB LFSR: xor the low two bits, shift right, feed the
+                    // result back into bit 14 (and bit 6 in 7-bit mode)
+                    uint16_t bit = (v.lfsr ^ (v.lfsr >> 1)) & 1;
+                    v.lfsr >>= 1;
+                    v.lfsr |= bit << 14;
+                    if (sevenBit) {
+                        v.lfsr = (v.lfsr & ~0x40) | (bit << 6);
+                    }
+                }
+                // Hardware outputs the inverted low bit
+                out[i] += (v.lfsr & 1) ? -amp : amp;
+            }
+        }
+    }
+}
+
+// ---- Worker-thread channel mixing ----
+// The callback used to synthesize every channel serially, capping the
+// whole synthesis budget at one core. Each GB channel now renders into
+// its own buffer on a dedicated worker pinned to a core: the callback
+// posts a semaphore per worker, spins briefly on their completion flags,
+// and only does the final SIMD mix-down itself. Handoff is an atomic
+// generation counter, so there are no locks on the block path; sem_post
+// is the one syscall, and only when a worker is actually parked.
+const unsigned long MIX_MAX_FRAMES = 1024;
+
+struct MixWorker {
+    alignas(16) float buffer[MIX_MAX_FRAMES];
+    std::atomic<uint32_t> armed{0};  // generation the worker should render
+    std::atomic<uint32_t> done{0};   // generation last completed
+    sem_t wake;
+    std::thread thread;
+};
+
+MixWorker MIX_WORKERS[4];
+std::atomic<bool> MIX_ACTIVE(false);  // workers running (live mode only)
+std::atomic<bool> MIX_RUN(true);
+unsigned long MIX_FRAMES = 0;  // written by the callback before arming
+
+static void mixWorkerMain(int channel) {
+    MixWorker& w = MIX_WORKERS[channel - 1];
+    while (true) {
+        // A signal can interrupt the wait; re-running on EINTR would
+        // re-render a stale generation into a buffer the callback may
+        // already be mixing down
+        while (sem_wait(&w.wake) == -1 && errno == EINTR) {}
+        if (!MIX_RUN.load(std::memory_order_acquire)) break;
+
+        uint32_t gen = w.armed.load(std::memory_order_acquire);
+        unsigned long frames = MIX_FRAMES;
+        std::fill(w.buffer, w.buffer + frames, 0.0f);
+        renderPool(VOICES, w.buffer, frames, channel);
+        w.done.store(gen, std::memory_order_release);
+    }
+}
+
+// Render the live pool across the workers and mix their buffers into out.
+// Falls back to inline rendering when the workers are not running (bench
+// mode) or the block is larger than the worker buffers
+static void renderParallel(float* out, unsigned long frames) {
+    // Clock articulation for this block before any channel renders
+    static FrameSequencer liveSeq;  // audio thread only
+    advanceFrameSequencer(VOICES, liveSeq, frames);
+
+    if (!MIX_ACTIVE.load(std::memory_order_relaxed) ||
+        frames > MIX_MAX_FRAMES) {
+        renderPool(VOICES, out, frames);
+        return;
+    }
+
+    static uint32_t generation = 0;  // audio thread only
+    generation++;
+    MIX_FRAMES = frames;
+    for (auto& w : MIX_WORKERS) {
+        w.armed.store(generation, std::memory_order_release);
+        sem_post(&w.wake);
+    }
+    for (auto& w : MIX_WORKERS) {
+        while (w.done.load(std::memory_order_acquire) != generation) {
+            std::this_thread::yield();
+        }
+    }
+
+    const float* b0 = MIX_WORKERS[0].buffer;
+    const float* b1 = MIX_WORKERS[1].buffer;
+    const float* b2 = MIX_WORKERS[2].buffer;
+    const float* b3 = MIX_WORKERS[3].buffer;
+    unsigned long i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= frames; i += 4) {
+        __m128 acc = _mm_loadu_ps(out + i);
+        acc = _mm_add_ps(acc, _mm_load_ps(b0 + i));
+        acc = _mm_add_ps(acc, _mm_load_ps(b1 + i));
+        acc = _mm_add_ps(acc, _mm_load_ps(b2 + i));
+        acc = _mm_add_ps(acc, _mm_load_ps(b3 + i));
+        _mm_storeu_ps(out + i, acc);
+    }
+#endif
+    for (; i < frames; i++) {
+        out[i] += b0[i] + b1[i] + b2[i] + b3[i];
+    }
+}
+
+// Spin up one pinned worker per channel; call before the stream starts
+void startMixWorkers() {
+    unsigned cores = std::thread::hardware_concurrency();
+    for (int c = 1; c <= 4; c++) {
+        MixWorker& w = MIX_WORKERS[c - 1];
+        sem_init(&w.wake, 0, 0);
+        w.thread = std::thread(mixWorkerMain, c);
+        if (cores > 1) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((c - 1) % cores, &set);
+            pthread_setaffinity_np(w.thread.native_handle(),
+                                   sizeof(set), &set);
+        }
+    }
+    MIX_ACTIVE.store(true, std::memory_order_release);
+}
+
+void stopMixWorkers() {
+    if (!MIX_ACTIVE.exchange(false)) return;
+    MIX_RUN.store(false, std::memory_order_release);
+    for (auto& w : MIX_WORKERS) {
+        sem_post(&w.wake);
+    }
+    for (auto& w : MIX_WORKERS) {
+        w.thread.join();
+        sem_destroy(&w.wake);
+    }
+}
+
+// ---- Offline render ----
+// Renders the current staff straight to a WAV without opening an audio
+// stream: each channel is synthesized on its own thread into its own
+// buffer from a private voice pool, then the four buffers are mixed,
+// clipped, and written in one pass. Minutes of music render in well under
+// a second instead of playing out in wall-clock time. Triggered with R.
+void renderStaffToWav(const std::string& filename) {
+    Sequence* seq = compileStaff();
+    if (!seq) {
+        std::cout << "Nothing to render" << std::endl;
+        return;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    uint64_t totalSamples = seq->endSample;
+
+    // One thread per channel, each with its own pool and output buffer
+    std::vector<float> channelBuf[4];
+    std::thread workers[4];
+    for (int c = 0; c < 4; c++) {
+        channelBuf[c].assign(totalSamples, 0.0f);
+        workers[c] = std::thread([seq, c, &channelBuf]() {
+            int channel = c + 1;
+            Voice pool[MAX_VOICES];
+            FrameSequencer frameSeq;
+            float* out = channelBuf[c].data();
+            const std::vector<SeqEvent>& events = seq->events;
+
+            uint64_t pos = 0;
+            size_t cursor = 0;
+            while (pos < seq->endSample) {
+                while (cursor < events.size() &&
+                       events[cursor].sampleTime <= pos) {
+                    const SeqEvent& ev = events[cursor++];
+                    if (ev.channel != channel) continue;
+                    if (ev.isOn) {
+                        poolVoiceOn(pool, channel, ev.frequency);
+                    } else {
+                        poolVoiceOff(pool, channel, ev.frequency);
+                    }
+                }
+
+                uint64_t run = seq->endSample - pos;
+                if (cursor < events.size()) {
+                    uint64_t next = events[cursor].sampleTime;
+                    if (next > pos && next - pos < run) {
+                        run = next - pos;
+                    }
+                }
+
+                advanceFrameSequencer(pool, frameSeq, run);
+                renderPool(pool, out + pos, run);
+                pos += run;
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    delete seq;
+
+    // Mix down, clip, and write
+    std::vector<float> mix(totalSamples, 0.0f);
+    for (int c = 0; c < 4; c++) {
+        for (uint64_t i = 0; i < totalSamples; i++) {
+            mix[i] += channelBuf[c][i];
+        }
+    }
+    for (uint64_t i = 0; i < totalSamples; i++) {
+        mix[i] = std::max(-1.0f, std::min(1.0f, mix[i]));
+    }
+
+    if (!writeWavMapped(filename, mix.data(), mix.size(), SAMPLE_RATE)) {
+        return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    std::cout << "Rendered " << totalSamples / SAMPLE_RATE << "s of audio in "
+              << elapsed.count() << "ms" << std::endl;
+}
+
+// Sequencer state owned by the audio thread
+static Sequence* activeSequence = nullptr;
+static size_t seqCursor = 0;
+
+// Apply one sequencer event to the voice pool. Each staff note gets its
+// own voice, so overlapping notes on one channel simply coexist.
+static void applySeqEvent(const SeqEvent& ev) {
+    if (ev.isOn) {
+        voiceOn(ev.channel, ev.frequency);
+    } else {
+        voiceOff(ev.channel, ev.frequency);
+    }
 }
 
 // Audio callback function for PortAudio
@@ -876,76 +2467,120 @@ static int audioCallback(const void* inputBuffer, void* outputBuffer,
                         void* userData) {
     (void) inputBuffer; // Unused parameter
     (void) timeInfo;    // Unused parameter
-    (void) statusFlags; // Unused parameter
     (void) userData;    // Unused parameter
-    
+
+    auto cbStart = std::chrono::steady_clock::now();
+
     float* out = (float*)outputBuffer;
-    
+
     // Generate silence by default
     for (unsigned int i = 0; i < framesPerBuffer; i++) {
         out[i] = 0.0f;
     }
-    
-    // Process Channel 1 (Pulse wave)
-    {
-        std::lock_guard<std::mutex> lock(CH1.lock);
-        if (CH1.active && CH1.frequency > 0) {
-            for (unsigned int i = 0; i < framesPerBuffer; i++) {
-                CH1.phase += 2.0f * M_PI * CH1.frequency / SAMPLE_RATE;
-                if (CH1.phase > 2.0f * M_PI) {
-                    CH1.phase -= 2.0f * M_PI;
-                }
-                out[i] += (CH1.phase < M_PI) ? AMPLITUDE : -AMPLITUDE;
-            }
+
+    // Apply any MIDI input that arrived since the last block. MIDI
+    // channels 1-4 map onto the GB channels; note-on at velocity zero is
+    // a release, per the spec
+    MidiEvent midi;
+    while (MIDI_RING.pop(midi)) {
+        int channel = (midi.status & 0x0F) % 4 + 1;
+        float freq = MIDI_NOTE_FREQ[midi.note & 0x7F];
+        if ((midi.status & 0xF0) == 0x90 && midi.velocity > 0) {
+            voiceOn(channel, freq);
+        } else {
+            voiceOff(channel, freq);
         }
     }
-    
-    // Process Channel 2 (Pulse wave)
-    {
-        std::lock_guard<std::mutex> lock(CH2.lock);
-        if (CH2.active && CH2.frequency > 0) {
-            for (unsigned int i = 0; i < framesPerBuffer; i++) {
-                CH2.phase += 2.0f * M_PI * CH2.frequency / SAMPLE_RATE;
-                if (CH2.phase > 2.0f * M_PI) {
-                    CH2.phase -= 2.0f * M_PI;
-                }
-                out[i] += (CH2.phase < M_PI) ? AMPLITUDE : -AMPLITUDE;
-            }
+
+    // Adopt a newly published sequence, but only while the retired slot
+    // is free: parking into an occupied slot would mean deleting here,
+    // and the real-time path must never touch the allocator. If the UI
+    // republishes before draining (two quick presses of P), adoption
+    // just waits a block; the pending pointer stays published
+    if (SEQ_RETIRED.load(std::memory_order_acquire) == nullptr) {
+        Sequence* pending = SEQ_PENDING.exchange(nullptr, std::memory_order_acq_rel);
+        if (pending) {
+            // Park the old sequence for the UI thread to free
+            SEQ_RETIRED.store(activeSequence, std::memory_order_release);
+            activeSequence = pending;
+            seqCursor = 0;
+            SEQ_SAMPLE.store(0, std::memory_order_release);
+            SEQ_ACTIVE.store(true, std::memory_order_release);
         }
     }
-    
-    // Process Channel 3 (Wave channel)
-    {
-        std::lock_guard<std::mutex> lock(CH3.lock);
-        if (CH3.active && CH3.frequency > 0) {
-            for (unsigned int i = 0; i < framesPerBuffer; i++) {
-                // Calculate how much to advance in the waveform
-                float phaseIncrement = CH3.frequency / SAMPLE_RATE;
-                CH3.phase += phaseIncrement;
-                
-                // Wrap phase if needed
-                if (CH3.phase >= 1.0f) {
-                    CH3.phase -= 1.0f;
+
+    unsigned long done = 0;
+
+    // Run the sequencer: render up to each event boundary, apply the event,
+    // and continue — note onsets land on exact samples
+    if (activeSequence && SEQ_ACTIVE.load(std::memory_order_relaxed)) {
+        uint64_t pos = SEQ_SAMPLE.load(std::memory_order_relaxed);
+        const std::vector<SeqEvent>& events = activeSequence->events;
+
+        while (done < framesPerBuffer) {
+            while (seqCursor < events.size() &&
+                   events[seqCursor].sampleTime <= pos) {
+                applySeqEvent(events[seqCursor++]);
+            }
+
+            if (seqCursor >= events.size() && pos >= activeSequence->endSample) {
+                allVoicesOff();
+                SEQ_ACTIVE.store(false, std::memory_order_release);
+                break;
+            }
+
+            uint64_t run = framesPerBuffer - done;
+            if (seqCursor < events.size()) {
+                uint64_t next = events[seqCursor].sampleTime;
+                if (next > pos && next - pos < run) {
+                    run = next - pos;
                 }
-                
-                // Map phase to waveform index (0 to 15)
-                size_t index = static_cast<size_t>(CH3.phase * 16) % 16;
-                
-                // Add the sample from the waveform
-                out[i] += CH3.waveform[index] * AMPLITUDE * 0.5f; // Slightly quieter
             }
+
+            renderParallel(out + done, run);
+            done += run;
+            pos += run;
         }
+
+        SEQ_SAMPLE.store(pos, std::memory_order_release);
     }
-    
-    // Clip and add to WAV buffer
+
+    // Live (keyboard-held) notes outside of sequence playback
+    if (done < framesPerBuffer) {
+        renderParallel(out + done, framesPerBuffer - done);
+    }
+
+    // Clip and hand off to the capture thread
     for (unsigned int i = 0; i < framesPerBuffer; i++) {
         out[i] = std::max(-1.0f, std::min(1.0f, out[i]));
-        WAV_BUFFER.push_back(out[i]);
+        CAPTURE_RING.push(out[i]);
     }
-    
+
+    auto cbEnd = std::chrono::steady_clock::now();
+    PERF.record(static_cast<uint32_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        cbEnd - cbStart).count()),
+                statusFlags);
+
     return paContinue;
 }
 
+// Set one wave sample from a mouse position inside the editor panel.
+// Returns false if the position is outside the panel, so callers can
+// skip a redraw. Shared by clicks and left-button drags, which makes
+// sketching a whole waveform one stroke instead of 16 clicks
+bool waveEditorSet(int x, int y) {
+    int panelH = 16 * WAVE_EDITOR_STEP;
+    if (x < WAVE_EDITOR_X || x >= WAVE_EDITOR_X + WAVE_SAMPLES * WAVE_EDITOR_COL ||
+        y < WAVE_EDITOR_Y || y >= WAVE_EDITOR_Y + panelH) {
+        return false;
+    }
+    int index = (x - WAVE_EDITOR_X) / WAVE_EDITOR_COL;
+    int level = 15 - (y - WAVE_EDITOR_Y) / WAVE_EDITOR_STEP;
+    setWaveLevel(index, level);
+    return true;
+}
+
 // Handle mouse clicks on UI elements
 void handleMouseClick(int x, int y, bool isRightClick) {
     // Check if click is on the staff
@@ -971,8 +2606,7 @@ void handleMouseClick(int x, int y, bool isRightClick) {
     // Check if click is on clear button
     if (x >= STAFF_X + 120 && x <= STAFF_X + 220 &&
         y >= STAFF_Y + STAFF_HEIGHT + 10 && y <= STAFF_Y + STAFF_HEIGHT + 40) {
-        staffNotes.clear();
-        isPlayingSequence = false;
+        clearStaff();
     }
     
     // Check if click is on left scroll button
@@ -990,8 +2624,8 @@ void handleMouseClick(int x, int y, bool isRightClick) {
     // Check if click is on channel selection
     if (x >= WINDOW_WIDTH - 150 && x <= WINDOW_WIDTH - 20 &&
         y >= 20 && y <= 50) {
-        // Cycle through channels: 1 -> 2 -> 3 -> 1
-        currentChannel = (currentChannel % 3) + 1;
+        // Cycle through channels: 1 -> 2 -> 3 -> 4 -> 1
+        currentChannel = (currentChannel % 4) + 1;
     }
     
     // Check if click is on note type selection
@@ -999,9 +2633,182 @@ void handleMouseClick(int x, int y, bool isRightClick) {
         y >= 60 && y <= 90) {
         currentNoteType = (currentNoteType == EIGHTH_NOTE) ? QUARTER_NOTE : EIGHTH_NOTE;
     }
+
+    // Check if click is in the wavetable editor
+    if (!isRightClick) {
+        waveEditorSet(x, y);
+    }
+}
+
+// ---- Microbenchmarks ----
+// `5gb --bench` times the hot paths without opening a window or an audio
+// device: audioCallback at several voice counts and buffer sizes, the
+// WAV conversion/write path, and renderStaff against generated staffs of
+// increasing size (into a software renderer). Numbers print to stdout so
+// optimization work can be compared against a recorded baseline.
+void runBenchmarks() {
+    using Clock = std::chrono::steady_clock;
+
+    // Synthesis: samples per second through the real callback
+    std::cout << "== synthesis ==" << std::endl;
+    float out[1024];
+    std::vector<int16_t> scratch;
+    for (int voices : {1, 2, 4, 8, 16}) {
+        for (int frames : {64, 256, 1024}) {
+            allVoicesOff();
+            for (int v = 0; v < voices; v++) {
+                int channel = (v % 4) + 1;
+                float freq = (channel == 4) ? 8192.0f : 220.0f + 55.0f * v;
+                voiceOn(channel, freq);
+            }
+
+            int iters = 2000000 / frames;
+            auto t0 = Clock::now();
+            for (int it = 0; it < iters; it++) {
+                audioCallback(nullptr, out, frames, nullptr, 0, nullptr);
+                if ((it & 63) == 0) {
+                    // Keep the capture ring from sitting at "full"
+                    scratch.clear();
+                    CAPTURE_RING.drainTo(scratch);
+                }
+            }
+            double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+            double rate = static_cast<double>(iters) * frames / secs;
+            std::cout << "  " << voices << " voices, " << frames
+                      << " frames/buffer: " << static_cast<long>(rate / 1000)
+                      << "k samples/sec" << std::endl;
+        }
+    }
+    allVoicesOff();
+
+    // WAV capture path: float->int16 conversion plus the stream write
+    std::cout << "== wav write ==" << std::endl;
+    {
+        const size_t count = 1 << 22;  // ~95s of audio
+        std::vector<float> samples(count);
+        for (size_t i = 0; i < count; i++) {
+            samples[i] = static_cast<float>((i & 255) - 128) / 128.0f;
+        }
+        WavWriter writer;
+        if (writer.open("bench_tmp.wav")) {
+            auto t0 = Clock::now();
+            writer.writeSamples(samples.data(), samples.size());
+            double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+            writer.close();
+            std::remove("bench_tmp.wav");
+            std::cout << "  " << count << " samples in " << secs * 1000.0
+                      << "ms (" << static_cast<long>(count / secs / 1000000.0)
+                      << "M samples/sec)" << std::endl;
+        }
+    }
+
+    // Staff rendering against a software renderer, growing note counts
+    std::cout << "== renderStaff ==" << std::endl;
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(
+        0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_RGBA8888);
+    SDL_Renderer* renderer = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+    if (renderer) {
+        initNoteAtlas(renderer);
+        const float freqs[] = {261.63f, 293.66f, 329.63f, 349.23f,
+                               392.00f, 440.00f, 493.88f, 523.25f};
+        for (int count : {10, 1000, 100000}) {
+            staffNotes.clear();
+            staffNotes.reserve(count);
+            for (int i = 0; i < count; i++) {
+                float f = freqs[i % 8];
+                staffNotes.push_back({f, NOTE_POSITIONS[f], i * 12,
+                                      (i % 4) + 1,
+                                      (i & 1) ? QUARTER_NOTE : EIGHTH_NOTE});
+            }
+
+            const int frames = 100;
+            auto t0 = Clock::now();
+            for (int f = 0; f < frames; f++) {
+                renderStaff(renderer);
+            }
+            double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+            std::cout << "  " << count << " notes: "
+                      << secs / frames * 1000.0 << "ms/frame ("
+                      << static_cast<long>(secs / frames / count * 1e9)
+                      << "ns/note)" << std::endl;
+        }
+        staffNotes.clear();
+        if (NOTE_ATLAS) {
+            SDL_DestroyTexture(NOTE_ATLAS);
+            NOTE_ATLAS = nullptr;
+        }
+        SDL_DestroyRenderer(renderer);
+    }
+    if (surface) {
+        SDL_FreeSurface(surface);
+    }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    initWavePattern();
+    bool bench = false;
+    int captureRate = 0;  // 0: follow the device rate
+    std::string renderProject, renderOutput;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--render" && i + 2 < argc) {
+            renderProject = argv[++i];
+            renderOutput = argv[++i];
+        } else if (arg == "--rate" && i + 1 < argc) {
+            int rate = std::atoi(argv[++i]);
+            if (rate != 44100 && rate != 48000 && rate != 96000) {
+                std::cerr << "Supported rates: 44100, 48000, 96000" << std::endl;
+                return 1;
+            }
+            SAMPLE_RATE = rate;
+        } else if (arg == "--buffer" && i + 1 < argc) {
+            int frames = std::atoi(argv[++i]);
+            if (frames < 64 || frames > 4096) {
+                std::cerr << "Buffer size must be 64..4096 frames" << std::endl;
+                return 1;
+            }
+            FRAMES_PER_BUFFER = static_cast<unsigned long>(frames);
+        } else if (arg == "--capture-rate" && i + 1 < argc) {
+            int rate = std::atoi(argv[++i]);
+            if (rate != 44100 && rate != 48000 && rate != 96000) {
+                std::cerr << "Supported rates: 44100, 48000, 96000" << std::endl;
+                return 1;
+            }
+            captureRate = rate;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--bench] [--render PROJECT.gbp OUT.wav]"
+                      << " [--rate HZ] [--buffer FRAMES] [--capture-rate HZ]"
+                      << std::endl;
+            return 1;
+        }
+    }
+    CAPTURE_RATE = captureRate ? captureRate : SAMPLE_RATE;
+    if (CAPTURE_RATE != SAMPLE_RATE) {
+        CAPTURE_RESAMPLER.init(SAMPLE_RATE, CAPTURE_RATE);
+    }
+
+    if (bench) {
+        runBenchmarks();
+        return 0;
+    }
+
+    // Headless render: straight from project file to WAV with no window,
+    // no renderer, and no audio device, so build servers can batch-render
+    // compositions in a scripted pipeline
+    if (!renderProject.empty()) {
+        if (!loadProject(renderProject)) {
+            return 1;
+        }
+        if (staffNotes.empty()) {
+            std::cerr << "Project has no notes to render" << std::endl;
+            return 1;
+        }
+        renderStaffToWav(renderOutput);
+        return 0;
+    }
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         std::cerr << "SDL initialization failed: " << SDL_GetError() << std::endl;
@@ -1033,7 +2840,13 @@ int main() {
     
     // Initialize piano keys
     initPianoKeys();
-    
+    initPianoGeometry();
+    initNoteDispatch();
+
+    // Bake the note glyphs into a texture atlas once
+    initNoteAtlas(renderer);
+
+
     // Initialize PortAudio
     PaError err = Pa_Initialize();
     if (err != paNoError) {
@@ -1052,7 +2865,7 @@ int main() {
         1,                 // 1 output channel
         paFloat32,         // 32-bit floating point output
         SAMPLE_RATE,       // Sample rate
-        256,               // Frames per buffer
+        FRAMES_PER_BUFFER, // Frames per buffer
         audioCallback,     // Callback function
         nullptr            // No user data
     );
@@ -1066,10 +2879,18 @@ int main() {
         return 1;
     }
     
+    // Per-channel synthesis workers must be up before the callback runs
+    startMixWorkers();
+
+#ifdef GB_MIDI
+    MIDI_THREAD = std::thread(midiThreadMain);
+#endif
+
     // Start audio stream
     err = Pa_StartStream(stream);
     if (err != paNoError) {
         std::cerr << "Error starting PortAudio stream: " << Pa_GetErrorText(err) << std::endl;
+        stopMixWorkers();
         Pa_CloseStream(stream);
         Pa_Terminate();
         SDL_DestroyRenderer(renderer);
@@ -1078,27 +2899,62 @@ int main() {
         return 1;
     }
     
+    // Let the UI thread poll the stream's CPU load for the perf HUD
+    AUDIO_STREAM = stream;
+
+    // Open the WAV output up front; samples stream to disk as we go
+    WAV_WRITER.open("gameboy_audio.wav", CAPTURE_RATE);
+
+    // Drain the capture ring on a normal-priority thread so the audio
+    // callback itself never touches the heap
+    std::thread captureThread([]() {
+        std::vector<int16_t> scratch;
+        while (!QUIT_FLAG) {
+            scratch.clear();
+            CAPTURE_RING.drainTo(scratch);
+            writeCapture(scratch);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    });
+
     std::cout << "Game Boy Audio Composer" << std::endl;
     std::cout << "Channel 1 (Pulse) keys: A-S-D-F-G-H-J" << std::endl;
     std::cout << "Channel 2 (Pulse) keys: Z-X-C-V-B-N-M" << std::endl;
     std::cout << "Channel 3 (Wave) keys: 1-2-3-4-5-6-7" << std::endl;
+    std::cout << "Channel 4 (Noise) keys: 8 (high), 9 (mid), 0 (low); L toggles 7-bit mode" << std::endl;
     std::cout << "Press a key to select a note, then click on the staff to place it" << std::endl;
     std::cout << "Right-click to remove notes" << std::endl;
     std::cout << "Press P to play the composition" << std::endl;
-    std::cout << "Press C to clear the staff" << std::endl;
+    std::cout << "Press R to render the composition to gameboy_render.wav" << std::endl;
+    std::cout << "Press Ctrl+S to save the project, O to load it (composition.gbp)" << std::endl;
+    std::cout << "Press C to clear the staff (Ctrl+Z undoes, Ctrl+Y redoes)" << std::endl;
     std::cout << "Press TAB to cycle through channels" << std::endl;
     std::cout << "Press N to toggle between eighth and quarter notes" << std::endl;
+    std::cout << "Press W to cycle pulse duty, E to flip the envelope, -/= for its period" << std::endl;
+    std::cout << "Press K to cycle the note length counter" << std::endl;
+    std::cout << "Click or drag in the right-hand panel to draw the wave channel's waveform" << std::endl;
     std::cout << "Press Q or ESC to quit..." << std::endl;
     
     // Main event loop
     SDL_Event event;
-    Uint32 lastUpdateTime = SDL_GetTicks();
-    
+
     while (!QUIT_FLAG) {
-        while (SDL_PollEvent(&event)) {
+        // Block waiting for input instead of spinning: a short timeout
+        // keeps the playback cursor animating, a longer one covers the
+        // idle case. Any event marks the frame dirty; SDL_RenderPresent
+        // invalidates the backbuffer, so a dirty frame is a full repaint
+        // rather than a partial one.
+        int timeout = (isPlayingSequence || isPlacingNote || showPerfHud) ? 10 : 100;
+        bool haveEvent = SDL_WaitEventTimeout(&event, timeout) != 0;
+        while (haveEvent) {
+            needsRedraw = true;
             if (event.type == SDL_QUIT) {
                 QUIT_FLAG = true;
-            } else if (event.type == SDL_KEYDOWN) {
+            } else if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
+                // Held keys auto-repeat KEYDOWN. Everything in here is
+                // edge-triggered, and the note path must only see real
+                // presses: each repeat would claim a fresh pool voice,
+                // while the single KEYUP releases exactly one
                 SDL_Keycode keycode = event.key.keysym.sym;
                 
                 // Check for quit keys
@@ -1111,15 +2967,35 @@ int main() {
                     startPlayback();
                 }
                 
-                // Check for clear key
+                // Check for clear key (recoverable with Ctrl+Z)
                 if (keycode == SDLK_c) {
-                    staffNotes.clear();
-                    isPlayingSequence = false;
+                    clearStaff();
+                }
+
+                // Undo / redo staff edits
+                if (keycode == SDLK_z && (SDL_GetModState() & KMOD_CTRL)) {
+                    undoEdit();
+                }
+                if (keycode == SDLK_y && (SDL_GetModState() & KMOD_CTRL)) {
+                    redoEdit();
+                }
+
+                // Offline render of the staff to a WAV
+                if (keycode == SDLK_r) {
+                    renderStaffToWav("gameboy_render.wav");
+                }
+
+                // Save / load the composition
+                if (keycode == SDLK_s && (SDL_GetModState() & KMOD_CTRL)) {
+                    saveProject("composition.gbp");
+                }
+                if (keycode == SDLK_o) {
+                    loadProject("composition.gbp");
                 }
                 
                 // Check for channel switch
                 if (keycode == SDLK_TAB) {
-                    currentChannel = (currentChannel == 1) ? 2 : 1;
+                    currentChannel = (currentChannel % 4) + 1;
                 }
                 
                 // Check for note type switch
@@ -1127,56 +3003,83 @@ int main() {
                     currentNoteType = (currentNoteType == EIGHTH_NOTE) ? QUARTER_NOTE : EIGHTH_NOTE;
                 }
                 
-                // Channel 1 note handling
-                auto it1 = CHANNEL1_NOTES.find(keycode);
-                if (it1 != CHANNEL1_NOTES.end()) {
-                    std::lock_guard<std::mutex> lock(CH1.lock);
-                    CH1.active = true;
-                    CH1.frequency = it1->second;
-                    updatePianoKeyState(keycode, true);
+                // Notes don't fire while a Ctrl shortcut (like save) is held
+                bool ctrlHeld = (SDL_GetModState() & KMOD_CTRL) != 0;
+
+                // Note handling for all channels: one table read
+                const NoteDispatch& nd = NOTE_DISPATCH[event.key.keysym.scancode];
+                if (nd.channel != 0 && !ctrlHeld) {
+                    voiceOn(nd.channel, nd.frequency);
+                    if (nd.pianoKey >= 0) {
+                        PianoKey& pk = pianoKeys[nd.pianoKey];
+                        pk.isActive = true;
+                        // Black keys light up but don't arm staff placement
+                        if (!pk.isBlack) {
+                            currentFrequency = pk.frequency;
+                            currentChannel = pk.channel;
+                            isPlacingNote = true;
+                        }
+                    } else {
+                        // No piano key for the wave/noise channels, but
+                        // still arm staff placement
+                        currentFrequency = nd.frequency;
+                        currentChannel = nd.channel;
+                        isPlacingNote = true;
+                    }
                 }
-                
-                // Channel 2 note handling
-                auto it2 = CHANNEL2_NOTES.find(keycode);
-                if (it2 != CHANNEL2_NOTES.end()) {
-                    std::lock_guard<std::mutex> lock(CH2.lock);
-                    CH2.active = true;
-                    CH2.frequency = it2->second;
-                    updatePianoKeyState(keycode, true);
+
+                // Toggle the LFSR width (15-bit hiss vs 7-bit metallic)
+                if (keycode == SDLK_l) {
+                    NOISE_SEVEN_BIT = !NOISE_SEVEN_BIT;
                 }
-                
-                // Channel 3 (Wave) note handling
-                auto it3 = CHANNEL3_NOTES.find(keycode);
-                if (it3 != CHANNEL3_NOTES.end()) {
-                    std::lock_guard<std::mutex> lock(CH3.lock);
-                    CH3.active = true;
-                    CH3.frequency = it3->second;
-                    // No piano key to update for wave channel
+
+                // Toggle the perf HUD
+                if (keycode == SDLK_F1) {
+                    showPerfHud = !showPerfHud;
                 }
-            } else if (event.type == SDL_KEYUP) {
-                SDL_Keycode keycode = event.key.keysym.sym;
-                
-                // Channel 1 note handling
-                auto it1 = CHANNEL1_NOTES.find(keycode);
-                if (it1 != CHANNEL1_NOTES.end()) {
-                    std::lock_guard<std::mutex> lock(CH1.lock);
-                    CH1.active = false;
-                    updatePianoKeyState(keycode, false);
+
+                // Pulse duty for new notes: 12.5 -> 25 -> 50 -> 75%
+                if (keycode == SDLK_w) {
+                    int duty = (PULSE_DUTY.load() + 1) % WAVETABLE_DUTIES;
+                    PULSE_DUTY.store(duty);
+                    std::cout << "Duty: " << WAVETABLE_DUTY[duty] * 100 << "%" << std::endl;
                 }
-                
-                // Channel 2 note handling
-                auto it2 = CHANNEL2_NOTES.find(keycode);
-                if (it2 != CHANNEL2_NOTES.end()) {
-                    std::lock_guard<std::mutex> lock(CH2.lock);
-                    CH2.active = false;
-                    updatePianoKeyState(keycode, false);
+
+                // Envelope direction and step period for new notes
+                if (keycode == SDLK_e) {
+                    ENV_UP.store(!ENV_UP.load());
+                    std::cout << "Envelope: " << (ENV_UP.load() ? "rising" : "decaying") << std::endl;
                 }
-                
-                // Channel 3 (Wave) note handling
-                auto it3 = CHANNEL3_NOTES.find(keycode);
-                if (it3 != CHANNEL3_NOTES.end()) {
-                    std::lock_guard<std::mutex> lock(CH3.lock);
-                    CH3.active = false;
+                // Length counter for new notes: off -> 1/16s -> 1/8s -> 1/4s
+                if (keycode == SDLK_k) {
+                    int len = NOTE_LENGTH.load();
+                    len = (len == 0) ? 16 : (len == 64) ? 0 : len * 2;
+                    NOTE_LENGTH.store(len);
+                    if (len == 0) {
+                        std::cout << "Length counter: off" << std::endl;
+                    } else {
+                        std::cout << "Length counter: " << len << "/256s" << std::endl;
+                    }
+                }
+
+                if (keycode == SDLK_MINUS || keycode == SDLK_EQUALS) {
+                    int period = ENV_PERIOD.load() + (keycode == SDLK_EQUALS ? 1 : -1);
+                    period = std::max(0, std::min(7, period));
+                    ENV_PERIOD.store(period);
+                    if (period == 0) {
+                        std::cout << "Envelope: off" << std::endl;
+                    } else {
+                        std::cout << "Envelope period: " << period << "/64s" << std::endl;
+                    }
+                }
+            } else if (event.type == SDL_KEYUP) {
+                // Note release for all channels: one table read
+                const NoteDispatch& nd = NOTE_DISPATCH[event.key.keysym.scancode];
+                if (nd.channel != 0) {
+                    voiceOff(nd.channel, nd.frequency);
+                    if (nd.pianoKey >= 0) {
+                        pianoKeys[nd.pianoKey].isActive = false;
+                    }
                 }
             } else if (event.type == SDL_MOUSEBUTTONDOWN) {
                 if (event.button.button == SDL_BUTTON_LEFT) {
@@ -1184,50 +3087,103 @@ int main() {
                 } else if (event.button.button == SDL_BUTTON_RIGHT) {
                     handleMouseClick(event.button.x, event.button.y, true);
                 }
+            } else if (event.type == SDL_MOUSEMOTION) {
+                // Dragging across the wave editor paints the waveform
+                if (event.motion.state & SDL_BUTTON_LMASK) {
+                    waveEditorSet(event.motion.x, event.motion.y);
+                }
             }
+
+            haveEvent = SDL_PollEvent(&event) != 0;
         }
-        
-        // Update playback at regular intervals
-        Uint32 currentTime = SDL_GetTicks();
-        if (currentTime - lastUpdateTime > 50) {  // 20 updates per second
-            updatePlayback();
-            lastUpdateTime = currentTime;
+
+        // Mirror the audio-thread playback position for drawing; marks the
+        // frame dirty when the cursor moved
+        updatePlayback();
+
+        // While the HUD is up, refresh it a few times a second; and every
+        // couple of seconds print the exact figures the bars approximate,
+        // then start a fresh measurement interval
+        static Uint32 lastHudRefresh = 0;
+        static Uint32 lastStatsLine = 0;
+        Uint32 now = SDL_GetTicks();
+        if (showPerfHud && now - lastHudRefresh >= 250) {
+            lastHudRefresh = now;
+            needsRedraw = true;
+        }
+        if (now - lastStatsLine >= 2000) {
+            lastStatsLine = now;
+            uint64_t count = PERF.callbackCount.load(std::memory_order_relaxed);
+            if (count > 0) {
+                uint64_t totalUs = PERF.callbackTotalUs.load(std::memory_order_relaxed);
+                printf("[perf] cb avg %.2fms max %.2fms p50 ~%.2fms p99 ~%.2fms "
+                       "xruns %u cpu %.1f%% frame %.1f/%.1fms\n",
+                       totalUs / (count * 1000.0),
+                       PERF.callbackMaxUs.load(std::memory_order_relaxed) / 1000.0,
+                       PERF.percentileUs(0.50) / 1000.0,
+                       PERF.percentileUs(0.99) / 1000.0,
+                       PERF.xruns.load(std::memory_order_relaxed),
+                       100.0 * Pa_GetStreamCpuLoad(stream),
+                       LAST_FRAME_MS, PEAK_FRAME_MS);
+            }
+            PERF.resetInterval();
+            PEAK_FRAME_MS = 0.0f;
+        }
+
+        // Repaint only when something changed
+        if (needsRedraw) {
+            auto frameStart = std::chrono::steady_clock::now();
+
+            // Clear screen
+            SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
+            SDL_RenderClear(renderer);
+
+            // Render piano
+            renderPiano(renderer);
+
+            // Render staff
+            renderStaff(renderer);
+
+            // Render UI
+            renderUI(renderer);
+
+            // Present renderer
+            SDL_RenderPresent(renderer);
+
+            LAST_FRAME_MS = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
+                std::chrono::steady_clock::now() - frameStart).count();
+            PEAK_FRAME_MS = std::max(PEAK_FRAME_MS, LAST_FRAME_MS);
+
+            needsRedraw = false;
         }
-        
-        // Clear screen
-        SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
-        SDL_RenderClear(renderer);
-        
-        // Render piano
-        renderPiano(renderer);
-        
-        // Render staff
-        renderStaff(renderer);
-        
-        // Render UI
-        renderUI(renderer);
-        
-        // Present renderer
-        SDL_RenderPresent(renderer);
-        
-        // Small delay to prevent high CPU usage
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
     
     // Cleanup
     Pa_StopStream(stream);
+    stopMixWorkers();
+#ifdef GB_MIDI
+    if (MIDI_THREAD.joinable()) {
+        MIDI_THREAD.join();
+    }
+#endif
+    captureThread.join();
+    // Pick up whatever the callback produced before the stream stopped
+    {
+        std::vector<int16_t> tail;
+        CAPTURE_RING.drainTo(tail);
+        writeCapture(tail);
+    }
     Pa_CloseStream(stream);
     Pa_Terminate();
+    if (NOTE_ATLAS) {
+        SDL_DestroyTexture(NOTE_ATLAS);
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
-    
-    // Save to WAV file
-    if (!WAV_BUFFER.empty()) {
-        saveWav("gameboy_audio.wav", WAV_BUFFER);
-    } else {
-        std::cout << "No audio data recorded" << std::endl;
-    }
-    
+
+    // Finalize the WAV file (patches header sizes)
+    WAV_WRITER.close();
+
     return 0;
 }